@@ -0,0 +1,331 @@
+#ifndef ASYNCBURNER_H
+#define ASYNCBURNER_H
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+#include "TextBurner.h"
+
+namespace netline {
+namespace module {
+
+/// Text of an asynchronous burn: a zone at rect, or a row under the previous ones when rect is empty
+struct BurnText {
+    std::wstring text;
+    cv::Rect rect;
+
+    static BurnText row(std::wstring text) { return BurnText{std::move(text), cv::Rect()};}
+    static BurnText row(const std::string_view text) { return BurnText{utf8::decode(text), cv::Rect()};}
+    static BurnText zone(const cv::Rect & rect, std::wstring text) { return BurnText{std::move(text), rect};}
+    static BurnText zone(const cv::Rect & rect, const std::string_view text) { return BurnText{utf8::decode(text), rect};}
+};
+
+/******************************************************************/
+
+/// Burns captions on its own threads, so the thread capturing frames only queues them.
+/// Frames of one stream are burned one at a time in the order they were submitted, different streams run in parallel.
+/// Frames are only read: the result is a new image, as with TextBurner::burnAllTextZones(destination), but a frame
+/// should not be written to until its job is done.
+/// The queue holds capacity jobs of all streams; when it is full, submit() either waits (BLOCK) or drops the oldest
+/// queued job (DROP_OLDEST), which keeps capture latency flat when burning falls behind
+class AsyncBurner {
+public:
+    enum OverflowPolicy {
+        BLOCK,
+        DROP_OLDEST
+    };
+
+    /// error is nullptr when result is the burned frame; dropped and cancelled jobs get a TextBurnerException
+    typedef std::function<void(cv::Mat result, std::exception_ptr error)> Callback;
+
+    /// threads: 0 - one per CPU. Every thread keeps its own TextBurner, the font file is mapped once
+    AsyncBurner(const std::string & path_to_font, const size_t threads = 0, const size_t capacity = 16,
+                const OverflowPolicy policy = BLOCK)
+        : m_capacity(capacity == 0 ? 1 : capacity),
+          m_policy(policy),
+          m_queued(0),
+          m_next_sequence(0),
+          m_setup_generation(0),
+          m_completed(0),
+          m_dropped(0),
+          m_stop(false) {
+        const size_t count = threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        /// burners are made here, so a bad font throws from the constructor
+        for (size_t i = 0; i < count; i++)
+            m_burners.emplace_back(new TextBurner(path_to_font));
+        for (size_t i = 0; i < count; i++)
+            m_threads.emplace_back([this, i]() { workerLoop(*m_burners[i]);});
+    }
+
+    /// Jobs queued before are still burned, use cancelAll() to drop them
+    ~AsyncBurner() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_job_ready.notify_all();
+        m_not_full.notify_all();
+        for (std::thread & thread : m_threads)
+            thread.join();
+    }
+
+    AsyncBurner(const AsyncBurner &) = delete;
+    AsyncBurner & operator=(const AsyncBurner &) = delete;
+
+    /// Settings for every burner (colors, effects, overlay mode...), applied by each thread before its next job
+    void configure(const std::function<void(TextBurner &)> & setup) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_setups.push_back(setup);
+        m_setup_generation++;
+    }
+
+    std::future<cv::Mat> submit(const size_t stream, cv::Mat frame, std::vector<BurnText> texts) {
+        std::shared_ptr<std::promise<cv::Mat>> promise = std::make_shared<std::promise<cv::Mat>>();
+        std::future<cv::Mat> result = promise->get_future();
+        submit(stream, std::move(frame), std::move(texts), [promise](cv::Mat burned, std::exception_ptr error) {
+            if (error != nullptr)
+                promise->set_exception(error);
+            else
+                promise->set_value(std::move(burned));
+        });
+        return result;
+    }
+
+    /// callback is called on a burning thread, or on the calling thread for a job dropped to make room for this one
+    void submit(const size_t stream, cv::Mat frame, std::vector<BurnText> texts, Callback callback) {
+        Job dropped;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_policy == BLOCK)
+                m_not_full.wait(lock, [this]() { return m_stop || m_queued < m_capacity; });
+            if (m_stop)
+                throw TextBurnerException("async burner is stopped");
+
+            if (m_queued >= m_capacity)
+                dropped = takeOldest();
+
+            Stream & state = m_streams[stream];
+            state.jobs.push_back(Job{m_next_sequence++, std::move(frame), std::move(texts), std::move(callback)});
+            m_queued++;
+            if (!state.busy)
+                m_ready.push_back(stream);
+        }
+        m_job_ready.notify_one();
+
+        if (dropped.callback)
+            dropped.callback(cv::Mat(), std::make_exception_ptr(TextBurnerException("burn job dropped, the queue is full")));
+    }
+
+    /// drops jobs of stream which have not started yet; returns their count
+    size_t cancel(const size_t stream) {
+        std::deque<Job> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto found = m_streams.find(stream);
+            if (found == m_streams.end())
+                return 0;
+
+            cancelled.swap(found->second.jobs);
+            m_queued -= cancelled.size();
+            m_dropped += cancelled.size();
+        }
+        m_not_full.notify_all();
+        m_idle.notify_all();
+        return notifyCancelled(cancelled);
+    }
+
+    /// drops every job which has not started yet; returns their count
+    size_t cancelAll() {
+        std::deque<Job> cancelled;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (auto & stream : m_streams) {
+                for (Job & job : stream.second.jobs)
+                    cancelled.push_back(std::move(job));
+                stream.second.jobs.clear();
+            }
+            m_queued = 0;
+            m_dropped += cancelled.size();
+        }
+        m_not_full.notify_all();
+        m_idle.notify_all();
+        return notifyCancelled(cancelled);
+    }
+
+    /// Waits until nothing is queued or burning
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() { return m_queued == 0 && m_burning == 0;});
+    }
+
+    size_t getQueuedCount() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queued;
+    }
+
+    size_t getCompletedCount() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_completed;
+    }
+
+    /// jobs dropped by DROP_OLDEST and cancelled ones
+    size_t getDroppedCount() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+    size_t getThreadsCount() const { return m_threads.size();}
+
+private:
+    struct Job {
+        size_t sequence = 0;
+        cv::Mat frame;
+        std::vector<BurnText> texts;
+        Callback callback;
+    };
+
+    struct Stream {
+        std::deque<Job> jobs;
+        bool busy = false; ///< a job of the stream is being burned
+    };
+
+    /// Removes the job submitted first among all queued ones; m_mutex is locked
+    Job takeOldest() {
+        Stream * oldest = nullptr;
+        for (auto & stream : m_streams) {
+            if (!stream.second.jobs.empty() && (oldest == nullptr || stream.second.jobs.front().sequence < oldest->jobs.front().sequence))
+                oldest = &stream.second;
+        }
+
+        Job job = std::move(oldest->jobs.front());
+        oldest->jobs.pop_front();
+        m_queued--;
+        m_dropped++;
+        return job;
+    }
+
+    size_t notifyCancelled(std::deque<Job> & cancelled) {
+        for (Job & job : cancelled) {
+            if (job.callback)
+                job.callback(cv::Mat(), std::make_exception_ptr(TextBurnerException("burn job cancelled")));
+        }
+        return cancelled.size();
+    }
+
+    void workerLoop(TextBurner & burner) {
+        size_t applied_setups = 0;
+        while (true) {
+            size_t stream = 0;
+            Job job;
+            std::vector<std::function<void(TextBurner &)>> setups;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true) {
+                    m_job_ready.wait(lock, [this]() { return m_stop || !m_ready.empty();});
+                    if (m_ready.empty())
+                        return;
+
+                    stream = m_ready.front();
+                    m_ready.pop_front();
+                    /// entries left by cancelled or dropped jobs are skipped, a busy stream is put back by its thread
+                    auto found = m_streams.find(stream);
+                    if (found == m_streams.end() || found->second.busy)
+                        continue;
+                    if (found->second.jobs.empty()) {
+                        m_streams.erase(found);
+                        continue;
+                    }
+
+                    job = std::move(found->second.jobs.front());
+                    found->second.jobs.pop_front();
+                    found->second.busy = true;
+                    break;
+                }
+                m_queued--;
+                m_burning++;
+                if (applied_setups != m_setup_generation) {
+                    setups.assign(m_setups.begin() + static_cast<long>(applied_setups), m_setups.end());
+                    applied_setups = m_setup_generation;
+                }
+            }
+            m_not_full.notify_one();
+
+            cv::Mat result;
+            std::exception_ptr error;
+            try {
+                for (const auto & setup : setups)
+                    setup(burner);
+                burn(burner, job, result);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            burner.clearData();
+            if (job.callback)
+                job.callback(std::move(result), error);
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                Stream & state = m_streams[stream];
+                state.busy = false;
+                if (!state.jobs.empty())
+                    m_ready.push_back(stream);
+                else
+                    m_streams.erase(stream);
+                m_burning--;
+                m_completed++;
+                if (m_queued == 0 && m_burning == 0)
+                    m_idle.notify_all();
+            }
+            m_job_ready.notify_one();
+        }
+    }
+
+    static void burn(TextBurner & burner, Job & job, cv::Mat & result) {
+        burner.setImage(&job.frame);
+        for (BurnText & text : job.texts) {
+            if (text.rect.empty())
+                burner.appendTextRow(text.text);
+            else
+                burner.appendTextZone(text.rect, text.text);
+        }
+        burner.burnAllTextZones(result);
+    }
+
+private:
+    const size_t m_capacity;
+    const OverflowPolicy m_policy;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_job_ready;
+    std::condition_variable m_not_full;
+    std::condition_variable m_idle;
+    std::unordered_map<size_t, Stream> m_streams;
+    std::deque<size_t> m_ready; ///< streams with jobs waiting for a thread
+    size_t m_queued;
+    size_t m_burning = 0;
+    size_t m_next_sequence;
+
+    std::vector<std::function<void(TextBurner &)>> m_setups;
+    size_t m_setup_generation;
+
+    size_t m_completed;
+    size_t m_dropped;
+    bool m_stop;
+
+    std::vector<std::unique_ptr<TextBurner>> m_burners;
+    std::vector<std::thread> m_threads;
+};
+
+}
+}
+
+#endif // ASYNCBURNER_H
@@ -0,0 +1,140 @@
+#ifndef BURNSTATS_H
+#define BURNSTATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+
+namespace netline {
+namespace module {
+
+/// Timings and counters of TextBurner::burnAllTextZones(), either of one burn or summed over burns
+struct BurnStats {
+    enum Stage {
+        PLACEMENT = 0,        ///< layout cache, scaling and bounds of zones
+        ROW_SPLITTING,        ///< folding text into rows
+        INTERSECTION_REMOVAL,
+        EMPTY_SPACE_REMOVAL,
+        GLYPH_RENDERING,      ///< FreeType rasterization of glyphs missing in the glyph cache
+        GLYPH_PLACEMENT,      ///< resolving glyphs and pen positions of zones
+        COMPOSITING,          ///< blending glyphs and drawing zone frames
+        IMAGE_GROWTH,         ///< appending the text band, copying to destination, darkening the overlay band
+        STAGES_COUNT
+    };
+
+    /// time of a stage does not include time of the stages nested into it, e.g. rendering glyphs while splitting rows
+    double stage_ms[STAGES_COUNT] = {};
+    double total_ms = 0.0;
+
+    size_t burns = 0;
+    size_t zones = 0;
+    size_t glyphs_rendered = 0;
+    size_t glyphs_drawn = 0;
+    size_t glyph_cache_hits = 0;
+    size_t layout_cache_hits = 0;
+    size_t layout_cache_misses = 0;
+    size_t pixels_blended = 0;  ///< glyph pixels inside the image
+    size_t bytes_allocated = 0; ///< image buffers and glyph bitmaps
+
+    static const char * stageName(const Stage stage) {
+        static const char * names[STAGES_COUNT] = {"placement", "row_splitting", "intersection_removal", "empty_space_removal",
+                                                   "glyph_rendering", "glyph_placement", "compositing", "image_growth"};
+        return stage < STAGES_COUNT ? names[stage] : "unknown";
+    }
+
+    void add(const BurnStats & other) {
+        for (int stage = 0; stage < STAGES_COUNT; stage++)
+            stage_ms[stage] += other.stage_ms[stage];
+        total_ms += other.total_ms;
+        burns += other.burns;
+        zones += other.zones;
+        glyphs_rendered += other.glyphs_rendered;
+        glyphs_drawn += other.glyphs_drawn;
+        glyph_cache_hits += other.glyph_cache_hits;
+        layout_cache_hits += other.layout_cache_hits;
+        layout_cache_misses += other.layout_cache_misses;
+        pixels_blended += other.pixels_blended;
+        bytes_allocated += other.bytes_allocated;
+    }
+};
+
+/******************************************************************/
+
+/// Collects BurnStats of the current burn. Code being measured holds a pointer to the recorder, which is null
+/// while stats are disabled: then a Scope is a single null check and no clock is read
+class BurnStatsRecorder {
+public:
+    typedef std::function<void(const BurnStats & last_burn, const BurnStats & total)> Callback;
+
+    /// Adds the time spent until destruction to stage
+    class Scope {
+    public:
+        Scope(BurnStatsRecorder * recorder, const BurnStats::Stage stage)
+            : m_recorder(recorder),
+              m_stage(stage),
+              m_nested_ms(0.0) {
+            if (m_recorder != nullptr) {
+                m_nested_ms = m_recorder->m_recorded_ms;
+                m_start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~Scope() {
+            if (m_recorder == nullptr)
+                return;
+
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+            /// scopes opened inside this one have already recorded their time
+            const double own_ms = ms - (m_recorder->m_recorded_ms - m_nested_ms);
+            m_recorder->m_burn.stage_ms[m_stage] += own_ms;
+            m_recorder->m_recorded_ms += own_ms;
+        }
+
+        Scope(const Scope &) = delete;
+        Scope & operator=(const Scope &) = delete;
+
+    private:
+        BurnStatsRecorder * m_recorder;
+        BurnStats::Stage m_stage;
+        double m_nested_ms;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    void beginBurn() {
+        m_burn = BurnStats();
+        m_recorded_ms = 0.0;
+        m_burn_start = std::chrono::steady_clock::now();
+    }
+
+    /// counters of the current burn
+    BurnStats & burn() { return m_burn;}
+
+    void endBurn() {
+        m_burn.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_burn_start).count();
+        m_burn.burns = 1;
+        m_total.add(m_burn);
+        if (m_callback)
+            m_callback(m_burn, m_total);
+    }
+
+    const BurnStats & getLastBurn() const { return m_burn;}
+    const BurnStats & getTotal() const { return m_total;}
+    void setCallback(const Callback & callback) { m_callback = callback;}
+
+    void reset() {
+        m_burn = BurnStats();
+        m_total = BurnStats();
+    }
+
+private:
+    BurnStats m_burn;
+    BurnStats m_total;
+    double m_recorded_ms = 0.0; ///< stage time recorded during the current burn
+    std::chrono::steady_clock::time_point m_burn_start;
+    Callback m_callback;
+};
+
+}
+}
+
+#endif // BURNSTATS_H
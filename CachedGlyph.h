@@ -0,0 +1,26 @@
+#ifndef CACHEDGLYPH_H
+#define CACHEDGLYPH_H
+
+#include <vector>
+
+namespace netline {
+namespace module {
+
+/// Rendered coverage bitmap of one glyph with everything needed to draw it without FreeType
+struct CachedGlyph {
+    std::vector<unsigned char> bitmap; ///< rows * width bytes, tightly packed; empty for glyphs of a GlyphAtlas
+    const unsigned char * atlas_bitmap = nullptr; ///< same layout, in the mapped atlas file
+    int width = 0;
+    int rows = 0;
+    int left = 0;  ///< bitmap_left, px
+    int top = 0;   ///< bitmap_top, px
+    long advance_x = 0;    ///< px
+    long vert_advance = 0; ///< px
+
+    const unsigned char * coverage() const { return atlas_bitmap != nullptr ? atlas_bitmap : bitmap.data();}
+};
+
+}
+}
+
+#endif // CACHEDGLYPH_H
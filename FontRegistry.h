@@ -0,0 +1,200 @@
+#ifndef FONTREGISTRY_H
+#define FONTREGISTRY_H
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include "TextBurnerException.h"
+
+namespace netline {
+namespace module {
+
+/// Read-only memory mapping of a whole file, pages are shared by every face made from it
+class MappedFile {
+public:
+    explicit MappedFile(const std::string & path)
+        : m_data(nullptr),
+          m_size(0) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw TextBurnerException("can not open font file " + path);
+
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            throw TextBurnerException("font file " + path + " is empty or unreadable");
+        }
+
+        m_size = static_cast<size_t>(info.st_size);
+        void * data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw TextBurnerException("can not map font file " + path);
+        m_data = static_cast<const unsigned char *>(data);
+    }
+
+    ~MappedFile() {
+        ::munmap(const_cast<unsigned char *>(m_data), m_size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    const unsigned char * data() const { return m_data;}
+    size_t size() const { return m_size;}
+
+private:
+    const unsigned char * m_data;
+    size_t m_size;
+};
+
+/******************************************************************/
+
+/// FreeType library shared by all faces. Creating and destroying faces of one library must not run concurrently,
+/// using a face is safe from one thread at a time
+struct SharedFtLibrary {
+    SharedFtLibrary() {
+        if (FT_Init_FreeType(&handle) != 0)
+            throw TextBurnerException("can not initialize FreeType");
+    }
+
+    ~SharedFtLibrary() {
+        FT_Done_FreeType(handle);
+    }
+
+    SharedFtLibrary(const SharedFtLibrary &) = delete;
+    SharedFtLibrary & operator=(const SharedFtLibrary &) = delete;
+
+    FT_Library handle;
+    std::mutex faces_mutex;
+};
+
+/******************************************************************/
+
+/// Face of its owner alone, on top of the font file mapped once per process.
+/// Keeps the file and the library alive until destruction
+class FontFace {
+public:
+    FontFace() : m_face(nullptr) {}
+
+    FontFace(std::shared_ptr<SharedFtLibrary> library, std::shared_ptr<const MappedFile> file, const std::string & path)
+        : m_library(std::move(library)),
+          m_file(std::move(file)),
+          m_face(nullptr) {
+        FT_Error error = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_library->faces_mutex);
+            error = FT_New_Memory_Face(m_library->handle, m_file->data(), static_cast<FT_Long>(m_file->size()), 0, &m_face);
+        }
+        if (error != 0)
+            throw TextBurnerException("can not load font " + path + ", FreeType error " + std::to_string(error));
+
+        FT_Select_Charmap(m_face, FT_ENCODING_UNICODE);
+    }
+
+    ~FontFace() {
+        release();
+    }
+
+    FontFace(FontFace && other) noexcept
+        : m_library(std::move(other.m_library)),
+          m_file(std::move(other.m_file)),
+          m_face(other.m_face) {
+        other.m_face = nullptr;
+    }
+
+    FontFace & operator=(FontFace && other) noexcept {
+        if (this != &other) {
+            release();
+            m_library = std::move(other.m_library);
+            m_file = std::move(other.m_file);
+            m_face = other.m_face;
+            other.m_face = nullptr;
+        }
+        return *this;
+    }
+
+    FontFace(const FontFace &) = delete;
+    FontFace & operator=(const FontFace &) = delete;
+
+    FT_Face get() const { return m_face;}
+
+private:
+    void release() {
+        if (m_face == nullptr)
+            return;
+
+        std::lock_guard<std::mutex> lock(m_library->faces_mutex);
+        FT_Done_Face(m_face);
+        m_face = nullptr;
+    }
+
+private:
+    std::shared_ptr<SharedFtLibrary> m_library;
+    std::shared_ptr<const MappedFile> m_file;
+    FT_Face m_face;
+};
+
+/******************************************************************/
+
+/// Process wide registry of font files: each file is mapped once and unmapped when its last face is destroyed
+class FontRegistry {
+public:
+    static FontRegistry & instance() {
+        static FontRegistry registry;
+        return registry;
+    }
+
+    /// A new face of the font, for one burner or one thread. Throws TextBurnerException if the font can not be loaded
+    FontFace openFace(const std::string & path) {
+        std::shared_ptr<const MappedFile> file;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::weak_ptr<const MappedFile> & entry = m_files[path];
+            file = entry.lock();
+            if (file == nullptr) {
+                file = std::make_shared<const MappedFile>(path);
+                entry = file;
+            }
+        }
+        return FontFace(m_library, std::move(file), path);
+    }
+
+    /// files currently mapped
+    size_t getLoadedFilesCount() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t count = 0;
+        for (auto it = m_files.begin(); it != m_files.end();) {
+            if (it->second.expired()) {
+                it = m_files.erase(it);
+            } else {
+                count++;
+                ++it;
+            }
+        }
+        return count;
+    }
+
+private:
+    FontRegistry()
+        : m_library(std::make_shared<SharedFtLibrary>()) {
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::weak_ptr<const MappedFile>> m_files;
+    std::shared_ptr<SharedFtLibrary> m_library; ///< faces hold it too, so it outlives the registry if needed
+};
+
+}
+}
+
+#endif // FONTREGISTRY_H
@@ -0,0 +1,268 @@
+#ifndef GLYPHATLAS_H
+#define GLYPHATLAS_H
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include "TextBurnerException.h"
+#include "FontRegistry.h"
+
+namespace netline {
+namespace module {
+
+/// Glyphs of one font rendered ahead of time for a set of pixel sizes and characters, read straight from a mapped file.
+/// Layout of the file (native byte order, every table 8-byte aligned):
+///   Header | int32 advance of 'w' for pixel sizes 1..w_table_size | Char[char_count] sorted by code point
+///   | Glyph[glyph_count] sorted by (pixel size, glyph index) | coverage bitmaps, rows * width bytes each
+class GlyphAtlas {
+public:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t face_glyphs_count;  ///< num_glyphs of the face, with family_hash tells if a face is the one the atlas was built from
+        uint64_t family_hash;
+        uint32_t units_per_em;
+        int32_t w_advance_units;     ///< unscaled advance of 'w'
+        uint32_t w_table_size;
+        uint32_t char_count;
+        uint32_t glyph_count;
+        uint32_t reserved;
+        uint64_t w_table_offset;
+        uint64_t char_table_offset;
+        uint64_t glyph_table_offset;
+        uint64_t bitmaps_offset;
+    };
+
+    struct Char {
+        uint32_t code_point;
+        uint32_t glyph_index;
+    };
+
+    struct Glyph {
+        uint32_t pixel_size; ///< x_ppem << 16 | y_ppem, as in GlyphCache
+        uint32_t glyph_index;
+        int32_t width;
+        int32_t rows;
+        int32_t left;
+        int32_t top;
+        int32_t advance_x;
+        int32_t vert_advance;
+        uint64_t bitmap_offset; ///< from the beginning of the bitmaps
+    };
+
+    static constexpr uint32_t VERSION = 1;
+
+    /// Throws TextBurnerException if the file is not an atlas or is damaged
+    explicit GlyphAtlas(const std::string & path)
+        : m_file(std::make_shared<const MappedFile>(path)) {
+        const unsigned char * data = m_file->data();
+        if (m_file->size() < sizeof(Header))
+            throw TextBurnerException("glyph atlas " + path + " is too short");
+
+        std::memcpy(&m_header, data, sizeof(Header));
+        if (std::memcmp(m_header.magic, MAGIC, sizeof(m_header.magic)) != 0 || m_header.version != VERSION)
+            throw TextBurnerException("glyph atlas " + path + " has unknown format");
+
+        if (!fits(m_header.w_table_offset, m_header.w_table_size * sizeof(int32_t))
+                || !fits(m_header.char_table_offset, m_header.char_count * sizeof(Char))
+                || !fits(m_header.glyph_table_offset, m_header.glyph_count * sizeof(Glyph))
+                || m_header.bitmaps_offset > m_file->size())
+            throw TextBurnerException("glyph atlas " + path + " is damaged");
+
+        m_w_advances = reinterpret_cast<const int32_t *>(data + m_header.w_table_offset);
+        m_chars = reinterpret_cast<const Char *>(data + m_header.char_table_offset);
+        m_glyphs = reinterpret_cast<const Glyph *>(data + m_header.glyph_table_offset);
+        m_bitmaps = data + m_header.bitmaps_offset;
+
+        const uint64_t bitmaps_size = m_file->size() - m_header.bitmaps_offset;
+        for (uint32_t i = 0; i < m_header.glyph_count; i++) {
+            const Glyph & glyph = m_glyphs[i];
+            /// the offset is checked on its own, offset + size could wrap around
+            if (glyph.width < 0 || glyph.rows < 0 || glyph.bitmap_offset > bitmaps_size
+                    || static_cast<uint64_t>(glyph.width) * static_cast<uint64_t>(glyph.rows) > bitmaps_size - glyph.bitmap_offset)
+                throw TextBurnerException("glyph atlas " + path + " is damaged");
+        }
+    }
+
+    /// true if the atlas was built from this font
+    bool matches(FT_Face face) const {
+        return static_cast<uint32_t>(face->num_glyphs) == m_header.face_glyphs_count && familyHash(face) == m_header.family_hash
+                && face->units_per_EM == m_header.units_per_em;
+    }
+
+    /// nullptr if the glyph was not rendered for this size
+    const Glyph * findGlyph(const uint32_t pixel_size, const uint glyph_index) const {
+        const Glyph * end = m_glyphs + m_header.glyph_count;
+        const Glyph * found = std::lower_bound(m_glyphs, end, std::make_pair(pixel_size, glyph_index),
+                                               [](const Glyph & glyph, const std::pair<uint32_t, uint> & key) {
+            return glyph.pixel_size < key.first || (glyph.pixel_size == key.first && glyph.glyph_index < key.second);
+        });
+        if (found == end || found->pixel_size != pixel_size || found->glyph_index != glyph_index)
+            return nullptr;
+        return found;
+    }
+
+    const unsigned char * getBitmap(const Glyph & glyph) const { return m_bitmaps + glyph.bitmap_offset;}
+
+    /// false if the character was not in the ranges the atlas was built for
+    bool findGlyphIndex(const uint32_t code_point, uint & glyph_index) const {
+        const Char * end = m_chars + m_header.char_count;
+        const Char * found = std::lower_bound(m_chars, end, code_point, [](const Char & symbol, const uint32_t value) {
+            return symbol.code_point < value;
+        });
+        if (found == end || found->code_point != code_point)
+            return false;
+        glyph_index = found->glyph_index;
+        return true;
+    }
+
+    /// hinted advance of 'w' at font_size, px; -1 if the size is out of the table
+    long getSymbolWidth(const uint font_size) const {
+        if (font_size == 0 || font_size > m_header.w_table_size)
+            return -1;
+        return m_w_advances[font_size - 1];
+    }
+
+    long getUnscaledSymbolWidth() const { return m_header.w_advance_units;}
+    long getUnitsPerEm() const { return m_header.units_per_em;}
+    size_t getGlyphsCount() const { return m_header.glyph_count;}
+
+    /// Renders every character of ranges (inclusive) that the font has at every pixel size and writes the atlas to path.
+    /// The advance of 'w' is stored for sizes 1..w_table_size, so font size estimation needs no FreeType either
+    static void build(FT_Face face, const std::vector<uint> & pixel_sizes, const std::vector<std::pair<uint32_t, uint32_t>> & ranges,
+                      const std::string & path, const uint w_table_size = 512) {
+        std::vector<Char> chars;
+        for (const auto & range : ranges) {
+            for (uint32_t code_point = range.first; code_point <= range.second; code_point++) {
+                const uint glyph_index = FT_Get_Char_Index(face, code_point);
+                if (glyph_index != 0)
+                    chars.push_back(Char{code_point, glyph_index});
+            }
+        }
+        std::sort(chars.begin(), chars.end(), [](const Char & a, const Char & b) { return a.code_point < b.code_point;});
+        chars.erase(std::unique(chars.begin(), chars.end(), [](const Char & a, const Char & b) { return a.code_point == b.code_point;}), chars.end());
+
+        std::vector<uint> glyph_indexes{0};
+        for (const Char & symbol : chars)
+            glyph_indexes.push_back(symbol.glyph_index);
+        std::sort(glyph_indexes.begin(), glyph_indexes.end());
+        glyph_indexes.erase(std::unique(glyph_indexes.begin(), glyph_indexes.end()), glyph_indexes.end());
+
+        std::vector<uint> sizes = pixel_sizes;
+        std::sort(sizes.begin(), sizes.end());
+        sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+
+        const uint w_index = FT_Get_Char_Index(face, static_cast<ulong>('w'));
+        std::vector<int32_t> w_advances;
+        for (uint font_size = 1; font_size <= w_table_size; font_size++) {
+            FT_Set_Pixel_Sizes(face, font_size, 0);
+            FT_Load_Glyph(face, w_index, FT_LOAD_DEFAULT);
+            w_advances.push_back(static_cast<int32_t>(face->glyph->advance.x / 64));
+        }
+
+        std::vector<Glyph> glyphs;
+        std::vector<unsigned char> bitmaps;
+        for (const uint font_size : sizes) {
+            FT_Set_Pixel_Sizes(face, font_size, 0);
+            const uint32_t pixel_size = static_cast<uint32_t>(face->size->metrics.x_ppem) << 16 | face->size->metrics.y_ppem;
+            for (const uint glyph_index : glyph_indexes) {
+                FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
+                FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+                const FT_GlyphSlot slot = face->glyph;
+
+                Glyph glyph;
+                glyph.pixel_size = pixel_size;
+                glyph.glyph_index = glyph_index;
+                glyph.width = static_cast<int32_t>(slot->bitmap.width);
+                glyph.rows = static_cast<int32_t>(slot->bitmap.rows);
+                glyph.left = slot->bitmap_left;
+                glyph.top = slot->bitmap_top;
+                glyph.advance_x = static_cast<int32_t>(slot->advance.x / 64);
+                glyph.vert_advance = static_cast<int32_t>(slot->metrics.vertAdvance / 64);
+                glyph.bitmap_offset = bitmaps.size();
+                for (int row = 0; row < glyph.rows; row++) {
+                    const unsigned char * src = slot->bitmap.buffer + row * slot->bitmap.pitch;
+                    bitmaps.insert(bitmaps.end(), src, src + glyph.width);
+                }
+                glyphs.push_back(glyph);
+            }
+        }
+
+        FT_Load_Glyph(face, w_index, FT_LOAD_NO_SCALE);
+
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.face_glyphs_count = static_cast<uint32_t>(face->num_glyphs);
+        header.family_hash = familyHash(face);
+        header.units_per_em = face->units_per_EM;
+        header.w_advance_units = static_cast<int32_t>(face->glyph->advance.x);
+        header.w_table_size = w_table_size;
+        header.char_count = static_cast<uint32_t>(chars.size());
+        header.glyph_count = static_cast<uint32_t>(glyphs.size());
+        header.w_table_offset = align(sizeof(Header));
+        header.char_table_offset = align(header.w_table_offset + w_advances.size() * sizeof(int32_t));
+        header.glyph_table_offset = align(header.char_table_offset + chars.size() * sizeof(Char));
+        header.bitmaps_offset = align(header.glyph_table_offset + glyphs.size() * sizeof(Glyph));
+
+        std::vector<unsigned char> file(header.bitmaps_offset + bitmaps.size(), 0);
+        std::memcpy(file.data(), &header, sizeof(header));
+        std::memcpy(file.data() + header.w_table_offset, w_advances.data(), w_advances.size() * sizeof(int32_t));
+        std::memcpy(file.data() + header.char_table_offset, chars.data(), chars.size() * sizeof(Char));
+        std::memcpy(file.data() + header.glyph_table_offset, glyphs.data(), glyphs.size() * sizeof(Glyph));
+        std::memcpy(file.data() + header.bitmaps_offset, bitmaps.data(), bitmaps.size());
+
+        FILE * out = std::fopen(path.c_str(), "wb");
+        if (out == nullptr)
+            throw TextBurnerException("can not create glyph atlas " + path);
+        const bool written = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+        if (std::fclose(out) != 0 || !written)
+            throw TextBurnerException("can not write glyph atlas " + path);
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'T', 'B', 'A', 'T', 'L', 'A', 'S', '\0'};
+
+    bool fits(const uint64_t offset, const uint64_t size) const {
+        return offset % 8 == 0 && offset <= m_file->size() && size <= m_file->size() - offset;
+    }
+
+    static uint64_t align(const uint64_t offset) {
+        return (offset + 7) / 8 * 8;
+    }
+
+    /// FNV-1a of family and style names
+    static uint64_t familyHash(FT_Face face) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const char * name : {face->family_name, face->style_name}) {
+            for (const char * c = name; c != nullptr && *c != '\0'; c++) {
+                hash ^= static_cast<unsigned char>(*c);
+                hash *= 1099511628211ULL;
+            }
+            hash ^= 0xFF;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+private:
+    std::shared_ptr<const MappedFile> m_file;
+    Header m_header;
+    const int32_t * m_w_advances;
+    const Char * m_chars;
+    const Glyph * m_glyphs;
+    const unsigned char * m_bitmaps;
+};
+
+}
+}
+
+#endif // GLYPHATLAS_H
@@ -0,0 +1,207 @@
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+#include <memory>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <unordered_map>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+#include "BurnStats.h"
+#include "CachedGlyph.h"
+#include "GlyphEffects.h"
+#include "GlyphAtlas.h"
+#include "SdfGlyphAtlas.h"
+
+namespace netline {
+namespace module {
+
+/// Keeps rendered glyphs between burns, keyed by (face, pixel size, glyph index).
+/// Glyphs found in the atlas, if one is set, are taken from it instead of being rendered.
+/// With an SDF atlas every glyph is resampled from its distance field instead.
+/// Outline and shadow layers of a glyph are made from its coverage once and kept next to it
+class GlyphCache {
+public:
+    /// Returns glyph for the size currently selected on face, rasterizing it on first use.
+    /// Reference stays valid until clear(), or with an SDF atlas until a glyph of another size is requested
+    const CachedGlyph & getGlyph(FT_Face face, const uint glyph_index) {
+        const Key key{face, pixelSizeOf(face), glyph_index};
+        if (m_sdf_atlas != nullptr && key.pixel_size != m_sdf_pixel_size) {
+            /// resampled glyphs are kept for one size only, fields are what stays
+            m_glyphs.clear();
+            m_effect_glyphs.clear();
+            m_bitmap_bytes = 0;
+            m_sdf_pixel_size = key.pixel_size;
+        }
+
+        auto found = m_glyphs.find(key);
+        if (found != m_glyphs.end()) {
+            m_hits++;
+            return found->second;
+        }
+
+        m_misses++;
+        if (m_sdf_atlas != nullptr) {
+            const CachedGlyph & glyph = m_glyphs.emplace(key, m_sdf_atlas->makeGlyph(face, glyph_index)).first->second;
+            m_bitmap_bytes += glyph.bitmap.size();
+            m_bitmap_bytes_allocated += glyph.bitmap.size();
+            return glyph;
+        }
+
+        if (m_atlas != nullptr) {
+            const GlyphAtlas::Glyph * atlas_glyph = m_atlas->findGlyph(key.pixel_size, glyph_index);
+            if (atlas_glyph != nullptr) {
+                m_atlas_hits++;
+                return m_glyphs.emplace(key, fromAtlas(*atlas_glyph)).first->second;
+            }
+        }
+
+        BurnStatsRecorder::Scope scope(m_stats, BurnStats::GLYPH_RENDERING);
+        const CachedGlyph & glyph = m_glyphs.emplace(key, renderGlyph(face, glyph_index)).first->second;
+        m_bitmap_bytes += glyph.bitmap.size();
+        m_bitmap_bytes_allocated += glyph.bitmap.size();
+        return glyph;
+    }
+
+    /// Layers of glyph for the effects set by setEffects(), glyph must come from this cache.
+    /// Reference stays valid as long as the glyph does
+    const EffectGlyph & getEffectGlyph(const CachedGlyph & glyph) {
+        auto found = m_effect_glyphs.find(&glyph);
+        if (found != m_effect_glyphs.end())
+            return found->second;
+
+        BurnStatsRecorder::Scope scope(m_stats, BurnStats::GLYPH_RENDERING);
+        const EffectGlyph & effect = m_effect_glyphs.emplace(&glyph, EffectGlyph::make(glyph, m_effects)).first->second;
+        m_bitmap_bytes += effect.layers.size();
+        m_bitmap_bytes_allocated += effect.layers.size();
+        return effect;
+    }
+
+    /// layers made for other outline width or shadow offset are dropped, colors do not matter here
+    void setEffects(const TextEffects & effects) {
+        if (!effects.sameShape(m_effects)) {
+            for (const auto & effect : m_effect_glyphs)
+                m_bitmap_bytes -= effect.second.layers.size();
+            m_effect_glyphs.clear();
+        }
+        m_effects = effects;
+    }
+
+    size_t getHits() const { return m_hits;}
+    size_t getMisses() const { return m_misses;}
+    /// misses served by the atlas, the rest of misses were rendered by FreeType
+    size_t getAtlasHits() const { return m_atlas_hits;}
+    size_t size() const { return m_glyphs.size();}
+    /// memory taken by glyph bitmaps
+    size_t getBitmapBytes() const { return m_bitmap_bytes;}
+    /// bitmap memory allocated since the cache was made; only grows, glyphs dropped on the way are still counted
+    size_t getAllocatedBitmapBytes() const { return m_bitmap_bytes_allocated;}
+
+    /// rendering time goes to recorder, nullptr turns it off
+    void setStats(BurnStatsRecorder * recorder) { m_stats = recorder;}
+
+    /// Atlas glyphs are drawn from the mapped file; the atlas stays alive while the cache refers to it
+    void setAtlas(std::shared_ptr<const GlyphAtlas> atlas) {
+        clear();
+        m_atlas = std::move(atlas);
+    }
+
+    const GlyphAtlas * getAtlas() const { return m_atlas.get();}
+
+    /// nullptr turns SDF rendering off; the atlas can be shared by caches of faces of the same font
+    void setSdfAtlas(std::shared_ptr<SdfGlyphAtlas> atlas) {
+        clear();
+        m_sdf_atlas = std::move(atlas);
+        m_sdf_pixel_size = 0;
+    }
+
+    const SdfGlyphAtlas * getSdfAtlas() const { return m_sdf_atlas.get();}
+
+    void clear() {
+        m_glyphs.clear();
+        m_effect_glyphs.clear();
+        m_hits = 0;
+        m_misses = 0;
+        m_atlas_hits = 0;
+        m_bitmap_bytes = 0;
+    }
+
+private:
+    struct Key {
+        FT_Face face;
+        uint32_t pixel_size;
+        uint glyph_index;
+
+        bool operator==(const Key & other) const {
+            return face == other.face && pixel_size == other.pixel_size && glyph_index == other.glyph_index;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key & key) const {
+            size_t hash = std::hash<const void *>()(key.face);
+            hash ^= (static_cast<size_t>(key.pixel_size) << 32 | key.glyph_index) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+    };
+
+    static uint32_t pixelSizeOf(FT_Face face) {
+        return static_cast<uint32_t>(face->size->metrics.x_ppem) << 16 | face->size->metrics.y_ppem;
+    }
+
+    CachedGlyph fromAtlas(const GlyphAtlas::Glyph & atlas_glyph) const {
+        CachedGlyph glyph;
+        glyph.atlas_bitmap = m_atlas->getBitmap(atlas_glyph);
+        glyph.width = atlas_glyph.width;
+        glyph.rows = atlas_glyph.rows;
+        glyph.left = atlas_glyph.left;
+        glyph.top = atlas_glyph.top;
+        glyph.advance_x = atlas_glyph.advance_x;
+        glyph.vert_advance = atlas_glyph.vert_advance;
+        return glyph;
+    }
+
+    static CachedGlyph renderGlyph(FT_Face face, const uint glyph_index) {
+        FT_GlyphSlot slot = face->glyph;
+        FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
+        FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
+
+        CachedGlyph glyph;
+        glyph.width = static_cast<int>(slot->bitmap.width);
+        glyph.rows = static_cast<int>(slot->bitmap.rows);
+        glyph.left = slot->bitmap_left;
+        glyph.top = slot->bitmap_top;
+        /// metrics are in 1/64th of a pixel, see TextLayout::measure()
+        glyph.advance_x = slot->advance.x / 64;
+        glyph.vert_advance = slot->metrics.vertAdvance / 64;
+
+        glyph.bitmap.resize(static_cast<size_t>(glyph.width * glyph.rows));
+        for (int row = 0; row < glyph.rows; row++) {
+            std::memcpy(glyph.bitmap.data() + row * glyph.width,
+                        slot->bitmap.buffer + row * slot->bitmap.pitch,
+                        static_cast<size_t>(glyph.width));
+        }
+        return glyph;
+    }
+
+private:
+    std::unordered_map<Key, CachedGlyph, KeyHash> m_glyphs;
+    std::unordered_map<const CachedGlyph *, EffectGlyph> m_effect_glyphs; ///< glyphs of m_glyphs are not moved by rehashing
+    TextEffects m_effects;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_atlas_hits = 0;
+    size_t m_bitmap_bytes = 0;
+    size_t m_bitmap_bytes_allocated = 0;
+    BurnStatsRecorder * m_stats = nullptr;
+    std::shared_ptr<const GlyphAtlas> m_atlas;
+    std::shared_ptr<SdfGlyphAtlas> m_sdf_atlas;
+    uint32_t m_sdf_pixel_size = 0; ///< size of the glyphs kept in SDF mode
+};
+
+}
+}
+
+#endif // GLYPHCACHE_H
@@ -0,0 +1,313 @@
+#ifndef GLYPHCOMPOSITOR_H
+#define GLYPHCOMPOSITOR_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+#include <opencv2/opencv.hpp>
+
+#include "GlyphEffects.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TEXTBURNER_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace netline {
+namespace module {
+
+/// Span blending kernels: dst[i] = dst[i] * (1 - alpha[i]) + color[i] * alpha[i], alpha in 0..255.
+/// All variants round identically, so output does not depend on the CPU the burner runs on
+namespace blend {
+
+typedef void (*BlendSpanFunction)(unsigned char * dst, const unsigned char * color, const unsigned char * alpha, size_t n);
+
+/// exact round(x / 255) for x <= 65025
+inline unsigned int div255(const unsigned int x) {
+    const unsigned int t = x + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+inline void blendSpanScalar(unsigned char * dst, const unsigned char * color, const unsigned char * alpha, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const unsigned int a = alpha[i];
+        dst[i] = static_cast<unsigned char>(div255(dst[i] * (255 - a) + color[i] * a));
+    }
+}
+
+#ifdef TEXTBURNER_X86_SIMD
+__attribute__((target("sse2")))
+inline __m128i blend8x16Sse2(const __m128i dst, const __m128i color, const __m128i alpha) {
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+    __m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(dst, inverse), _mm_mullo_epi16(color, alpha)), bias);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+inline void blendSpanSse2(unsigned char * dst, const unsigned char * color, const unsigned char * alpha, size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(color + i));
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(alpha + i));
+        const __m128i lo = blend8x16Sse2(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(c, zero), _mm_unpacklo_epi8(a, zero));
+        const __m128i hi = blend8x16Sse2(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(c, zero), _mm_unpackhi_epi8(a, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    blendSpanScalar(dst + i, color + i, alpha + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i blend8x16Avx2(const __m256i dst, const __m256i color, const __m256i alpha) {
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), alpha);
+    __m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dst, inverse), _mm256_mullo_epi16(color, alpha)), bias);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+inline void blendSpanAvx2(unsigned char * dst, const unsigned char * color, const unsigned char * alpha, size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    /// unpack and pack both work inside 128-bit lanes, so byte order is preserved
+    for (; i + 32 <= n; i += 32) {
+        const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+        const __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(color + i));
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(alpha + i));
+        const __m256i lo = blend8x16Avx2(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(c, zero), _mm256_unpacklo_epi8(a, zero));
+        const __m256i hi = blend8x16Avx2(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(c, zero), _mm256_unpackhi_epi8(a, zero));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), _mm256_packus_epi16(lo, hi));
+    }
+    blendSpanSse2(dst + i, color + i, alpha + i, n - i);
+}
+#endif
+
+/// Picks the widest kernel supported by the running CPU
+inline BlendSpanFunction selectBlendSpan() {
+#ifdef TEXTBURNER_X86_SIMD
+    if (__builtin_cpu_supports("avx2"))
+        return blendSpanAvx2;
+    if (__builtin_cpu_supports("sse2"))
+        return blendSpanSse2;
+#endif
+    return blendSpanScalar;
+}
+
+}
+
+/******************************************************************/
+
+/// Compile time description of a supported cv::Mat pixel layout, T is uchar or ushort
+template <typename T, int CN>
+struct PixelFormat {
+    typedef T value_type;
+    static const int channels = CN;
+    static const int type = CV_MAKETYPE(sizeof(T) == 1 ? CV_8U : CV_16U, CN);
+    static constexpr double max_value = static_cast<double>(std::numeric_limits<T>::max());
+};
+
+typedef PixelFormat<uchar, 1> Pixel8UC1;
+typedef PixelFormat<uchar, 3> Pixel8UC3;
+typedef PixelFormat<uchar, 4> Pixel8UC4;
+typedef PixelFormat<ushort, 1> Pixel16UC1;
+typedef PixelFormat<ushort, 3> Pixel16UC3;
+
+/******************************************************************/
+
+/// Blends glyph coverage bitmaps into an image with text color and opacity, and layers of glyphs with effects
+/// with the colors of their layers. The inner loop is instantiated per pixel format and picked once per image by setImageType()
+class GlyphCompositor {
+public:
+    GlyphCompositor()
+        : m_blend_span(blend::selectBlendSpan()),
+          m_burn(nullptr),
+          m_burn_layers(nullptr),
+          m_max_value(0.0) {
+        setLayerColor(EffectGlyph::SHADOW, cv::Scalar(0, 0, 0, 255), 0.0);
+        setLayerColor(EffectGlyph::OUTLINE, cv::Scalar(0, 0, 0, 255), 0.0);
+        setTextColor(cv::Scalar(255, 255, 255, 255), 1.0);
+    }
+
+    static bool isSupportedType(const int type) {
+        return type == Pixel8UC1::type || type == Pixel8UC3::type || type == Pixel8UC4::type
+                || type == Pixel16UC1::type || type == Pixel16UC3::type;
+    }
+
+    /// returns false if the type is not one of isSupportedType()
+    bool setImageType(const int type) {
+        switch (type) {
+        case Pixel8UC1::type: selectFormat<Pixel8UC1>(); return true;
+        case Pixel8UC3::type: selectFormat<Pixel8UC3>(); return true;
+        case Pixel8UC4::type: selectFormat<Pixel8UC4>(); return true;
+        case Pixel16UC1::type: selectFormat<Pixel16UC1>(); return true;
+        case Pixel16UC3::type: selectFormat<Pixel16UC3>(); return true;
+        default:
+            m_burn = nullptr;
+            m_burn_layers = nullptr;
+            return false;
+        }
+    }
+
+    /// color components are 0..255 in image channel order (BGR for cv::imread images) and are scaled to the image depth,
+    /// so the same color works for 8 and 16 bit images. opacity in [0, 1]
+    void setTextColor(const cv::Scalar & color, const double opacity) {
+        setLayerColor(EffectGlyph::FILL, color, opacity);
+    }
+
+    /// same as setTextColor() for a layer of glyphs with effects, a layer with opacity 0 is skipped
+    void setLayerColor(const EffectGlyph::Layer layer, const cv::Scalar & color, const double opacity) {
+        LayerColor & target = m_layers[layer];
+        target.color = color;
+        const double clamped_opacity = std::min(1.0, std::max(0.0, opacity));
+        for (int coverage = 0; coverage < 256; coverage++)
+            target.alpha_lut[coverage] = cv::saturate_cast<unsigned char>(coverage * clamped_opacity);
+
+        target.visible = clamped_opacity > 0.0;
+        target.color_row.clear();
+    }
+
+    /// Maps a 0..255 color to the value range of the selected image type
+    cv::Scalar toImageScale(const cv::Scalar & color) const {
+        return color * (m_max_value / 255.0);
+    }
+
+    /// Blend coverage (width x rows, row stride pitch) with its top left corner at (x, y), clipped to image bounds.
+    /// image must have the type passed to setImageType()
+    void burn(cv::Mat & image, const unsigned char * coverage, const int width, const int rows, const int pitch,
+              const int x, const int y) {
+        (this->*m_burn)(image, coverage, width, rows, pitch, x, y);
+    }
+
+    /// Blends shadow, outline and fill of glyph with the top left corner of its box at (x, y), clipped to image bounds.
+    /// Every row of the box gets all its layers before the next row is touched
+    void burnLayers(cv::Mat & image, const EffectGlyph & glyph, const int x, const int y) {
+        (this->*m_burn_layers)(image, glyph, x, y);
+    }
+
+private:
+    typedef void (GlyphCompositor::*BurnFunction)(cv::Mat &, const unsigned char *, int, int, int, int, int);
+    typedef void (GlyphCompositor::*BurnLayersFunction)(cv::Mat &, const EffectGlyph &, int, int);
+
+    /// color of one layer, opacity is folded into the coverage to alpha table
+    struct LayerColor {
+        cv::Scalar color;
+        unsigned char alpha_lut[256];
+        bool visible = false;
+        int channels = 0;
+        std::vector<unsigned char> color_row;
+    };
+
+    template <typename Format>
+    void selectFormat() {
+        m_burn = &GlyphCompositor::burnFormat<Format>;
+        m_burn_layers = &GlyphCompositor::burnLayersFormat<Format>;
+        m_max_value = Format::max_value;
+        for (LayerColor & layer : m_layers)
+            layer.color_row.clear();
+    }
+
+    template <typename Format>
+    void burnFormat(cv::Mat & image, const unsigned char * coverage, const int width, const int rows, const int pitch,
+                    const int x, const int y) {
+        typedef typename Format::value_type T;
+        const int channels = Format::channels;
+
+        const cv::Rect visible = cv::Rect(x, y, width, rows) & cv::Rect(0, 0, image.cols, image.rows);
+        if (visible.empty())
+            return;
+
+        const size_t span = static_cast<size_t>(visible.width * channels);
+        LayerColor & fill = m_layers[EffectGlyph::FILL];
+        prepareRows<T>(fill, channels, span);
+
+        for (int row = visible.y; row < visible.y + visible.height; row++) {
+            const unsigned char * src = coverage + (row - y) * pitch + (visible.x - x);
+            T * dst = image.ptr<T>(row) + visible.x * channels;
+            blendRow<T, channels>(fill, dst, src, visible.width);
+        }
+    }
+
+    template <typename Format>
+    void burnLayersFormat(cv::Mat & image, const EffectGlyph & glyph, const int x, const int y) {
+        typedef typename Format::value_type T;
+        const int channels = Format::channels;
+
+        const cv::Rect visible = cv::Rect(x, y, glyph.width, glyph.rows) & cv::Rect(0, 0, image.cols, image.rows);
+        if (visible.empty())
+            return;
+
+        const size_t span = static_cast<size_t>(visible.width * channels);
+        for (LayerColor & layer : m_layers)
+            prepareRows<T>(layer, channels, span);
+
+        for (int row = visible.y; row < visible.y + visible.height; row++) {
+            T * dst = image.ptr<T>(row) + visible.x * channels;
+            const size_t offset = static_cast<size_t>((row - y) * glyph.width + (visible.x - x));
+            for (int layer = 0; layer < EffectGlyph::LAYERS_COUNT; layer++) {
+                if (m_layers[layer].visible)
+                    blendRow<T, channels>(m_layers[layer], dst, glyph.plane(static_cast<EffectGlyph::Layer>(layer)) + offset, visible.width);
+            }
+        }
+    }
+
+    /// 8-bit rows: expand alpha per channel and hand the span to the SIMD kernel
+    template <typename T, int CN>
+    typename std::enable_if<sizeof(T) == 1>::type blendRow(const LayerColor & layer, T * dst, const unsigned char * coverage, const int width) {
+        unsigned char * alpha = m_alpha_row.data();
+        for (int col = 0; col < width; col++) {
+            const unsigned char a = layer.alpha_lut[coverage[col]];
+            for (int channel = 0; channel < CN; channel++)
+                *alpha++ = a;
+        }
+        m_blend_span(dst, layer.color_row.data(), m_alpha_row.data(), static_cast<size_t>(width * CN));
+    }
+
+    /// 16-bit rows: alpha is widened to 0..65535, blended in 32-bit integers
+    template <typename T, int CN>
+    typename std::enable_if<sizeof(T) == 2>::type blendRow(const LayerColor & layer, T * dst, const unsigned char * coverage, const int width) {
+        const T * color = reinterpret_cast<const T *>(layer.color_row.data());
+        for (int col = 0; col < width; col++, dst += CN) {
+            const uint32_t a = layer.alpha_lut[coverage[col]] * 257u;
+            if (a == 0)
+                continue;
+
+            for (int channel = 0; channel < CN; channel++)
+                dst[channel] = static_cast<T>((dst[channel] * (65535u - a) + color[channel] * a + 32767u) / 65535u);
+        }
+    }
+
+    /// color repeated per pixel, grown to the widest span seen so far
+    template <typename T>
+    void prepareRows(LayerColor & layer, const int channels, const size_t span) {
+        if (layer.channels != channels)
+            layer.color_row.clear();
+
+        if (layer.color_row.size() < span * sizeof(T)) {
+            layer.channels = channels;
+            layer.color_row.resize(span * sizeof(T));
+            const cv::Scalar color = toImageScale(layer.color);
+            T * values = reinterpret_cast<T *>(layer.color_row.data());
+            for (size_t i = 0; i < span; i++)
+                values[i] = cv::saturate_cast<T>(color[static_cast<int>(i % static_cast<size_t>(channels))]);
+        }
+
+        if (m_alpha_row.size() < span)
+            m_alpha_row.resize(span);
+    }
+
+private:
+    blend::BlendSpanFunction m_blend_span;
+    BurnFunction m_burn;
+    BurnLayersFunction m_burn_layers;
+    double m_max_value;
+    LayerColor m_layers[EffectGlyph::LAYERS_COUNT];
+    std::vector<unsigned char> m_alpha_row;
+};
+
+}
+}
+
+#endif // GLYPHCOMPOSITOR_H
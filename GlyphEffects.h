@@ -0,0 +1,133 @@
+#ifndef GLYPHEFFECTS_H
+#define GLYPHEFFECTS_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "CachedGlyph.h"
+
+namespace netline {
+namespace module {
+
+/// Outline and drop shadow drawn under the text, so it stays readable on bright footage
+struct TextEffects {
+    int outline_width = 0; ///< px, 0 - no outline
+    cv::Scalar outline_color = cv::Scalar(0, 0, 0, 255);
+    double outline_opacity = 1.0;
+
+    cv::Point shadow_offset = cv::Point(2, 2); ///< px, right and down
+    cv::Scalar shadow_color = cv::Scalar(0, 0, 0, 255);
+    double shadow_opacity = 0.0; ///< 0 - no shadow
+
+    bool hasOutline() const { return outline_width > 0 && outline_opacity > 0.0;}
+    bool hasShadow() const { return shadow_opacity > 0.0;}
+    bool enabled() const { return hasOutline() || hasShadow();}
+
+    /// effect bitmaps depend on these only, colors are applied while compositing
+    bool sameShape(const TextEffects & other) const {
+        return hasOutline() == other.hasOutline() && hasShadow() == other.hasShadow()
+                && (!hasOutline() || outline_width == other.outline_width)
+                && (!hasShadow() || (shadow_offset.x == other.shadow_offset.x && shadow_offset.y == other.shadow_offset.y));
+    }
+};
+
+/******************************************************************/
+
+/// Coverage layers of a glyph with effects, all in one box: shadow, outline and fill planes of rows * width bytes each.
+/// Layers are blended in this order, one row of every layer after another, so the box is walked once
+struct EffectGlyph {
+    enum Layer {
+        SHADOW,
+        OUTLINE,
+        FILL,
+        LAYERS_COUNT
+    };
+
+    std::vector<unsigned char> layers;
+    int width = 0;
+    int rows = 0;
+    int left = 0; ///< px from the pen position, as CachedGlyph::left
+    int top = 0;  ///< px above the baseline, as CachedGlyph::top
+
+    const unsigned char * plane(const Layer layer) const {
+        return layers.data() + static_cast<size_t>(layer) * static_cast<size_t>(width * rows);
+    }
+
+    /// Outline is the fill dilated by a disc of outline_width px with an antialiased edge, shadow is the outline
+    /// (or the fill without outline) moved by shadow_offset
+    static EffectGlyph make(const CachedGlyph & glyph, const TextEffects & effects) {
+        EffectGlyph effect;
+        if (glyph.width == 0 || glyph.rows == 0)
+            return effect;
+
+        const int radius = effects.hasOutline() ? effects.outline_width : 0;
+        const cv::Point shift = effects.hasShadow() ? effects.shadow_offset : cv::Point(0, 0);
+        /// box of the fill in effect coordinates
+        const int fill_x = radius - std::min(0, shift.x);
+        const int fill_y = radius - std::min(0, shift.y);
+        effect.width = glyph.width + 2 * radius + std::abs(shift.x);
+        effect.rows = glyph.rows + 2 * radius + std::abs(shift.y);
+        effect.left = glyph.left - fill_x;
+        effect.top = glyph.top + fill_y;
+        effect.layers.assign(static_cast<size_t>(LAYERS_COUNT * effect.width * effect.rows), 0);
+
+        unsigned char * fill = effect.layers.data() + FILL * effect.width * effect.rows;
+        const unsigned char * coverage = glyph.coverage();
+        for (int row = 0; row < glyph.rows; row++)
+            std::copy(coverage + row * glyph.width, coverage + (row + 1) * glyph.width, fill + (fill_y + row) * effect.width + fill_x);
+
+        const unsigned char * shape = fill;
+        if (radius > 0) {
+            dilate(fill, effect.width, effect.rows, radius, effect.layers.data() + OUTLINE * effect.width * effect.rows);
+            shape = effect.plane(OUTLINE);
+        }
+
+        if (effects.hasShadow()) {
+            unsigned char * shadow = effect.layers.data() + SHADOW * effect.width * effect.rows;
+            for (int row = std::max(0, shift.y); row < std::min(effect.rows, effect.rows + shift.y); row++) {
+                for (int col = std::max(0, shift.x); col < std::min(effect.width, effect.width + shift.x); col++)
+                    shadow[row * effect.width + col] = shape[(row - shift.y) * effect.width + col - shift.x];
+            }
+        }
+        return effect;
+    }
+
+private:
+    /// Grayscale dilation: every pixel takes the max of its neighbours within radius, weighted by how much of the pixel
+    /// the disc covers. Done once per glyph and size, the cost does not matter next to burning
+    static void dilate(const unsigned char * source, const int width, const int rows, const int radius, unsigned char * target) {
+        struct Tap {
+            int dx;
+            int dy;
+            unsigned int weight; ///< 0..256
+        };
+        std::vector<Tap> taps;
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                const double weight = std::min(1.0, std::max(0.0, radius + 0.5 - std::sqrt(static_cast<double>(dx * dx + dy * dy))));
+                if (weight > 0.0)
+                    taps.push_back(Tap{dx, dy, static_cast<unsigned int>(std::lround(weight * 256.0))});
+            }
+        }
+
+        for (int row = 0; row < rows; row++) {
+            for (int col = 0; col < width; col++) {
+                unsigned int value = 0;
+                for (const Tap & tap : taps) {
+                    const int x = col + tap.dx;
+                    const int y = row + tap.dy;
+                    if (x >= 0 && y >= 0 && x < width && y < rows)
+                        value = std::max(value, (source[y * width + x] * tap.weight + 128) >> 8);
+                }
+                target[row * width + col] = static_cast<unsigned char>(value);
+            }
+        }
+    }
+};
+
+}
+}
+
+#endif // GLYPHEFFECTS_H
@@ -0,0 +1,173 @@
+#ifndef SDFGLYPHATLAS_H
+#define SDFGLYPHATLAS_H
+
+#include <mutex>
+#include <cmath>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+#include FT_MODULE_H
+#include FT_SIZES_H
+
+#include "TextBurnerException.h"
+#include "CachedGlyph.h"
+
+namespace netline {
+namespace module {
+
+/// Signed distance field of one glyph at the base size of its SdfGlyphAtlas
+struct SdfGlyph {
+    std::vector<unsigned char> field; ///< rows * width, 128 on the outline, growing inwards by 128 / spread per px
+    int width = 0;
+    int rows = 0;
+    int left = 0; ///< px of the base size, the field is padded by spread px on every side
+    int top = 0;
+    long advance_x = 0;    ///< 1/64 px of the base size, unhinted
+    long vert_advance = 0; ///< 1/64 px of the base size, unhinted
+};
+
+/// Glyphs rasterized by FreeType once, as distance fields at a single base size, and drawn at any pixel size
+/// by resampling the field. Memory does not depend on how many sizes are drawn, so one atlas per font
+/// can be shared by every burner of the font, whatever their image widths are
+class SdfGlyphAtlas {
+public:
+    explicit SdfGlyphAtlas(const uint base_size = 64)
+        : m_base_size(base_size),
+          m_spread(8) {
+    }
+
+    uint getBaseSize() const { return m_base_size;}
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_glyphs.size();
+    }
+
+    /// memory taken by fields
+    size_t getFieldBytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_field_bytes;
+    }
+
+    /// Coverage glyph for the size currently selected on face, made from the field of glyph_index.
+    /// The field is rendered on first use of the glyph with any size; the size of face is left as it was.
+    /// Safe to call from burners on different threads, each with its own face of the same font
+    CachedGlyph makeGlyph(FT_Face face, const uint glyph_index) {
+        const double scale = static_cast<double>(face->size->metrics.y_ppem) / m_base_size;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        checkFont(face);
+        auto found = m_glyphs.find(glyph_index);
+        if (found == m_glyphs.end())
+            found = m_glyphs.emplace(glyph_index, renderField(face, glyph_index)).first;
+        return resample(found->second, scale);
+    }
+
+private:
+    /// fields of one atlas must come from one font
+    void checkFont(FT_Face face) {
+        const std::string family = std::string(face->family_name != nullptr ? face->family_name : "")
+                + " " + (face->style_name != nullptr ? face->style_name : "");
+        if (m_family.empty()) {
+            m_family = family;
+            m_glyphs_in_face = face->num_glyphs;
+        } else if (m_family != family || m_glyphs_in_face != face->num_glyphs) {
+            throw TextBurnerException("SDF glyph atlas of " + m_family + " can not be used with " + family);
+        }
+    }
+
+    /// Renders at the base size through a size object of its own, so the size selected on face is not disturbed
+    SdfGlyph renderField(FT_Face face, const uint glyph_index) {
+        FT_Size current_size = face->size;
+        FT_Size base_size = nullptr;
+        if (FT_New_Size(face, &base_size) != 0)
+            throw TextBurnerException("can not create FreeType size for SDF rendering");
+        FT_Activate_Size(base_size);
+        FT_Set_Pixel_Sizes(face, m_base_size, 0);
+
+        FT_Property_Get(face->glyph->library, "sdf", "spread", &m_spread);
+
+        /// hinting is made for one size, the field is drawn at all of them
+        SdfGlyph glyph;
+        const FT_GlyphSlot slot = face->glyph;
+        if (FT_Load_Glyph(face, glyph_index, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP) == 0) {
+            glyph.advance_x = slot->advance.x;
+            glyph.vert_advance = slot->metrics.vertAdvance;
+            if (FT_Render_Glyph(slot, FT_RENDER_MODE_SDF) == 0) {
+                glyph.width = static_cast<int>(slot->bitmap.width);
+                glyph.rows = static_cast<int>(slot->bitmap.rows);
+                glyph.left = slot->bitmap_left;
+                glyph.top = slot->bitmap_top;
+                glyph.field.resize(static_cast<size_t>(glyph.width * glyph.rows));
+                for (int row = 0; row < glyph.rows; row++) {
+                    std::memcpy(glyph.field.data() + row * glyph.width,
+                                slot->bitmap.buffer + row * slot->bitmap.pitch,
+                                static_cast<size_t>(glyph.width));
+                }
+            }
+        }
+
+        FT_Activate_Size(current_size);
+        FT_Done_Size(base_size);
+        m_field_bytes += glyph.field.size();
+        return glyph;
+    }
+
+    /// Samples the field bilinearly at pixel centers of the target size; the outline gets a 1 px wide antialiasing ramp
+    CachedGlyph resample(const SdfGlyph & sdf, const double scale) const {
+        CachedGlyph glyph;
+        glyph.advance_x = std::lround(sdf.advance_x * scale / 64.0);
+        glyph.vert_advance = std::lround(sdf.vert_advance * scale / 64.0);
+        if (sdf.field.empty() || scale <= 0.0)
+            return glyph;
+
+        glyph.left = static_cast<int>(std::floor(sdf.left * scale));
+        glyph.top = static_cast<int>(std::ceil(sdf.top * scale));
+        glyph.width = static_cast<int>(std::ceil((sdf.left + sdf.width) * scale)) - glyph.left;
+        glyph.rows = glyph.top - static_cast<int>(std::floor((sdf.top - sdf.rows) * scale));
+        glyph.bitmap.assign(static_cast<size_t>(glyph.width * glyph.rows), 0);
+
+        const double px_per_level = static_cast<double>(m_spread) / 128.0 * scale;
+        auto level = [&](const int col, const int row) -> double {
+            if (col < 0 || row < 0 || col >= sdf.width || row >= sdf.rows)
+                return 0.0;
+            return sdf.field[static_cast<size_t>(row * sdf.width + col)];
+        };
+
+        for (int y = 0; y < glyph.rows; y++) {
+            /// field coordinates of the target pixel center
+            const double field_y = (y + 0.5 - glyph.top) / scale + sdf.top - 0.5;
+            const int row = static_cast<int>(std::floor(field_y));
+            const double fy = field_y - row;
+            unsigned char * out = glyph.bitmap.data() + y * glyph.width;
+            for (int x = 0; x < glyph.width; x++) {
+                const double field_x = (glyph.left + x + 0.5) / scale - sdf.left - 0.5;
+                const int col = static_cast<int>(std::floor(field_x));
+                const double fx = field_x - col;
+                const double value = (level(col, row) * (1.0 - fx) + level(col + 1, row) * fx) * (1.0 - fy)
+                        + (level(col, row + 1) * (1.0 - fx) + level(col + 1, row + 1) * fx) * fy;
+                const double distance = (value - 128.0) * px_per_level; ///< target px, positive inside
+                out[x] = static_cast<unsigned char>(std::lround(std::min(1.0, std::max(0.0, distance + 0.5)) * 255.0));
+            }
+        }
+        return glyph;
+    }
+
+private:
+    const uint m_base_size;
+    int m_spread; ///< px of the base size, the FreeType "sdf" module property
+    mutable std::mutex m_mutex;
+    std::unordered_map<uint, SdfGlyph> m_glyphs;
+    size_t m_field_bytes = 0;
+    std::string m_family;
+    long m_glyphs_in_face = 0;
+};
+
+}
+}
+
+#endif // SDFGLYPHATLAS_H
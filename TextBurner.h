@@ -2,154 +2,33 @@
 #define TEXTBURNER_H
 
 #include <map>
-#include <locale>
+#include <list>
+#include <deque>
+#include <memory>
+#include <istream>
+#include <functional>
+#include <unordered_map>
 #include <utility>
-#include <codecvt>
+#include <string_view>
 #include <opencv2/opencv.hpp>
 #include <freetype2/ft2build.h>
 #include FT_FREETYPE_H
 
+#include "TextBurnerException.h"
+#include "FontRegistry.h"
+#include "GlyphCache.h"
+#include "GlyphCompositor.h"
+#include "TextLayout.h"
+#include "TextZoneStore.h"
+#include "ZoneGrid.h"
+#include "ZoneSkyline.h"
+#include "WorkerPool.h"
+#include "BurnStats.h"
+#include "Utf8.h"
+
 namespace netline {
 namespace module {
 
-/// Handle line folding and scale height of text
-class TextZone {
-public:
-    TextZone(const std::wstring & text, const cv::Rect & zone, FT_Face & face, int text_space = 0)
-        : m_text(text),
-          m_text_space(text_space),
-          m_zone(zone),
-          m_ft_face(face) {
-    }
-
-    void move(const cv::Point move_to) {
-        m_zone.x = move_to.x;
-        m_zone.y = move_to.y;
-    }
-
-    void shift(const int x, const int y) {
-        m_zone.x += x;
-        m_zone.y += y;
-    }
-
-    void scale(const double scale_factor) {
-        m_zone.x = static_cast<int>(m_zone.x * scale_factor);
-        m_zone.y = static_cast<int>(m_zone.y * scale_factor);
-        m_zone.width = static_cast<int>(m_zone.width * scale_factor);
-        m_zone.height = static_cast<int>(m_zone.height * scale_factor);
-    }
-
-    void resize(const int width, const int height) {
-        m_zone.width = width;
-        m_zone.height = height;
-    }
-
-    cv::Rect getZoneRect() const { return m_zone;}
-    std::vector<std::wstring> getWTextRows() const { return m_text_rows;}
-
-    /// main function to split text into lines and adjusting height of it
-    void createRowsFromText(const bool fit_text_zone_height_to_rows) {
-        createTextRowsAndExpandHeightIfNeeded(fit_text_zone_height_to_rows);
-    }
-
-private:
-    void createTextRowsAndExpandHeightIfNeeded(const bool fit_text_zone_height_to_rows) {
-        std::vector<std::wstring> words;
-        std::wstringstream wss(m_text);
-        std::wstring word;
-        while(std::getline(wss, word, L' ')) {
-            word.insert(0, 1, L' ');
-            words.push_back(word);
-        }
-
-        /// removing extra spaces
-        /// (!)take into account that all new words after the first one go with space at the beginning
-        words.front().erase(0, 1);
-
-        int symbol_width = static_cast<int>(calculateStringWidth(L"w"));
-        int symbol_height = static_cast<int>(calculateStringHeight());
-
-        /// добавляем строку и увеличиваем высоту зоны, если нужно
-        m_text_rows.push_back(std::wstring());
-        if (m_zone.height < symbol_height)
-            resize(m_zone.width, symbol_height);
-
-        const size_t max_symbols_in_row = static_cast<size_t>(m_zone.width / symbol_width);
-        /// calculate words and split lines acording to it. If single word is too big we are going to use char-by-char split
-        for (auto iter = words.begin(); iter != words.end(); iter++) {
-            size_t word_length = iter->size();
-
-            if (static_cast<size_t>(word_length + m_text_rows.back().size()) > max_symbols_in_row) {
-                if (m_text_rows.back().empty()) {
-                    // $TODO: the whole word is too big for one line, critical case which should be handled
-                    // we need char by char folding
-                    if (iter->front() == L' ')
-                        iter->erase(0,1);
-
-                    m_text_rows.back().append(iter->substr(0, static_cast<size_t>(max_symbols_in_row)));
-                    iter->erase(0, static_cast<size_t>(max_symbols_in_row));
-                    m_text_rows.push_back(std::wstring());
-                    iter--;
-                } else {
-                    /// sending new word to a new line
-                    m_text_rows.push_back(std::wstring());
-                    /// removing space at the beginning
-                    iter->erase(0,1);
-                    iter--;
-                    if (m_zone.height < symbol_height * static_cast<int>(m_text_rows.size()))
-                        resize(m_zone.width, symbol_height);
-                }
-
-            } else {
-                m_text_rows.back().append(*iter);
-            }
-        }
-
-        /// adding some height if initial value is not enough
-        /// fit_text_zone_height_to_rows - флаг, который означает что высоту текстовой_зоны будем подгонять под ее содержимое
-        const int needed_height = symbol_height * static_cast<int>(m_text_rows.size());
-        if (m_zone.height < needed_height || fit_text_zone_height_to_rows)
-            resize(m_zone.width, needed_height);
-
-        resize(m_zone.width, m_zone.height + m_text_space);
-    }
-
-    uint calculateStringWidth(const std::wstring &string) const {
-        const uint glyph_index = FT_Get_Char_Index(m_ft_face, static_cast<ulong>('w'));
-        const uint string_size = static_cast<uint>(string.size());
-
-        FT_GlyphSlot slot = m_ft_face->glyph;
-
-        FT_Load_Glyph(m_ft_face, glyph_index, FT_LOAD_DEFAULT);
-        FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-
-        /* FreeType 2 uses size objects to model all information related to a given character size for a given face.
-         * For example, a size object holds the value of certain metrics like the ascender or text height,
-         * expressed in 1/64th of a pixel, for a character size of 12 points (however, those values are rounded to integers, i.e., multiples of 64).
-         */
-        return static_cast<uint>(string_size * (slot->advance.x / 64));
-    }
-
-    uint calculateStringHeight() const {
-        const uint glyph_index = FT_Get_Char_Index(m_ft_face, static_cast<ulong>('w'));
-        FT_GlyphSlot slot = m_ft_face->glyph;
-
-        FT_Load_Glyph(m_ft_face, glyph_index, FT_LOAD_DEFAULT );
-        FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-
-        return static_cast<uint>(slot->metrics.vertAdvance / 64);
-    }
-
-private:
-    std::wstring m_text;
-    int m_text_space;
-    cv::Rect m_zone;
-    FT_Face & m_ft_face;
-    std::vector<std::wstring> m_text_rows;
-};
-
-/******************************************************************/
-
 class TextPositioner {
 public:
     enum WorkModeFlag {
@@ -164,7 +43,8 @@ public:
 
 public:
     TextPositioner(const int image_width)
-        : m_image_width(image_width) {
+        : m_image_width(image_width),
+          m_operate_flags(0) {
         setOperateFlags(REMOVE_EMPTY_SPACE_Y | SCALE_Y | NO_INTERSECTIONS | TEXT_ZONE_HEIGHT_UP_TO_TEXT);
     }
 
@@ -173,50 +53,68 @@ public:
         /// REMOVE_EMPTY_SPACE_Y | SCALE_Y | NO_INTERSECTIONS | TEXT_ZONE_HEIGHT_UP_TO_TEXT
         
         /// All other combinations are for future and this function should be updated ::placeCorrectlyTextZones()
+        m_operate_flags = flags;
+        m_work_mode.clear();
         for (uint32_t i = 0; i < calculateWorkModeFlagPositionInEnum(END_FLAG); i++)
             m_work_mode.push_back(static_cast<bool>(flags & (1 << i)));
     }
 
-    static uint calculateMonoSpaceFontSize(FT_Face & face,const int image_width) {
-        const uint glyph_index = FT_Get_Char_Index(face, static_cast<ulong>('w'));
-        const uint min_font_size = 12;
-        const uint symbols_in_row = 80;
-
-        uint font_size = 20;
-        FT_Set_Pixel_Sizes(face, font_size, 0);
-        FT_GlyphSlot slot = face->glyph;
-
-        FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-        FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
+    uint32_t getOperateFlags() const { return m_operate_flags;}
 
-        /* FreeType 2 uses size objects to model all information related to a given character size for a given face.
-         * For example, a size object holds the value of certain metrics like the ascender or text height,
-         * expressed in 1/64th of a pixel, for a character size of 12 points (however, those values are rounded to integers, i.e., multiples of 64).
-        */
-        long symbol_width = slot->advance.x / 64;
+    /// stage timings of placement go to recorder, nullptr turns them off
+    void setStats(BurnStatsRecorder * recorder) { m_stats = recorder;}
 
-        /// increase font size until string with symbols_in_row do not exceed the width of image
-        while (symbol_width * symbols_in_row < image_width) {
-            font_size++;
-            FT_Set_Pixel_Sizes(face, font_size, 0);
-            FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-            FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-            symbol_width = slot->advance.x / 64;
+    /// Pixel size at which symbols_in_row glyphs 'w' fill image_width, but not less than min_font_size.
+    /// Gives the same size as stepping one pixel at a time from 20 px, starting from a guess made on unscaled metrics.
+    /// Advances stored in atlas are used instead of loading glyphs, when it has them
+    static uint calculateMonoSpaceFontSize(FT_Face & face, const int image_width,
+                                           const uint symbols_in_row = 80, const uint min_font_size = 12,
+                                           const GlyphAtlas * atlas = nullptr) {
+        const uint glyph_index = FT_Get_Char_Index(face, static_cast<ulong>('w'));
+        const uint start_font_size = 20;
+
+        /// unscaled advance (font units) gives the answer up to hinting rounding, so only a couple of sizes get probed
+        long advance_units = 0;
+        if (atlas != nullptr) {
+            advance_units = atlas->getUnscaledSymbolWidth();
+        } else {
+            FT_Load_Glyph(face, glyph_index, FT_LOAD_NO_SCALE);
+            advance_units = face->glyph->advance.x;
         }
-
-        /// decrease font size until string with symbols_in_row fits the width of image
-        while (symbol_width * symbols_in_row > image_width) {
-            font_size--;
-            FT_Set_Pixel_Sizes(face, font_size, 0);
-            FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-            FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-            symbol_width = slot->advance.x / 64;
+        uint guess = start_font_size;
+        if (advance_units > 0)
+            guess = static_cast<uint>(std::max(1L, static_cast<long>(image_width) * face->units_per_EM / (static_cast<long>(symbols_in_row) * advance_units)));
+
+        auto row_width = [&](const uint font_size) {
+            long symbol_width = atlas != nullptr ? atlas->getSymbolWidth(font_size) : -1;
+            if (symbol_width < 0)
+                symbol_width = calculateSymbolWidth(face, glyph_index, font_size);
+            return symbol_width * static_cast<long>(symbols_in_row);
+        };
+
+        uint font_size = 0;
+        if (row_width(start_font_size) < image_width) {
+            /// the first size at which a row reaches the width of image, or the one before it if the row gets too wide
+            font_size = std::max(start_font_size + 1, guess);
+            while (font_size > start_font_size + 1 && row_width(font_size - 1) >= image_width)
+                font_size--;
+            while (row_width(font_size) < image_width)
+                font_size++;
+            if (row_width(font_size) > image_width)
+                font_size--;
+        } else {
+            /// the largest size up to start_font_size at which a row fits the width of image
+            font_size = std::min(start_font_size, guess);
+            while (font_size < start_font_size && row_width(font_size + 1) <= image_width)
+                font_size++;
+            while (font_size > 1 && row_width(font_size) > image_width)
+                font_size--;
         }
 
         return font_size >= min_font_size ? font_size : min_font_size;
     }
 
-    void placeCorrectlyTextZones(std::vector<TextZone> & text_zones) {
+    void placeCorrectlyTextZones(TextZoneStore & text_zones) {
         //    setOperateFlags(REMOVE_EMPTY_SPACE_X | SCALE_Y | NO_INTERSECTIONS | TEXT_ZONE_HEIGHT_UP_TO_TEXT);
         const bool no_intersections = m_work_mode.at(calculateWorkModeFlagPositionInEnum(NO_INTERSECTIONS));
         const bool text_zone_up_to_height = m_work_mode.at(calculateWorkModeFlagPositionInEnum(TEXT_ZONE_HEIGHT_UP_TO_TEXT));
@@ -224,6 +122,7 @@ public:
         const bool scale_y = m_work_mode.at(calculateWorkModeFlagPositionInEnum(SCALE_Y));
 
         if (no_intersections) {
+            BurnStatsRecorder::Scope scope(m_stats, BurnStats::INTERSECTION_REMOVAL);
             removeIntersections(text_zones);
         }
 
@@ -231,8 +130,7 @@ public:
         if (scale_y) {
             cv::Point left_top(INT_MAX, INT_MAX);
             cv::Point right_bottom(INT_MIN, INT_MIN);
-            for (auto zone : text_zones) {
-                cv::Rect rect = zone.getZoneRect();
+            for (const cv::Rect & rect : text_zones.getZoneRects()) {
                 left_top.x = std::min(left_top.x, rect.x);
                 left_top.y = std::min(left_top.y, rect.y);
 
@@ -241,60 +139,57 @@ public:
             }
             scale_factor = static_cast<double>(m_image_width) / static_cast<double>(right_bottom.x - left_top.x);
 
-            for (auto & zone : text_zones)
-                zone.scale(scale_factor);
+            for (size_t i = 0; i < text_zones.size(); i++)
+                text_zones.scale(i, scale_factor);
         }
 
         /// scaling text and printing it to image
-        for (auto & text_zone : text_zones) {
-            text_zone.createRowsFromText(text_zone_up_to_height);
+        {
+            BurnStatsRecorder::Scope scope(m_stats, BurnStats::ROW_SPLITTING);
+            text_zones.clearRows();
+            for (size_t i = 0; i < text_zones.size(); i++)
+                text_zones.createRowsFromText(i, text_zone_up_to_height);
         }
 
         if (text_zone_up_to_height) {
             if (no_intersections) {
+                BurnStatsRecorder::Scope scope(m_stats, BurnStats::INTERSECTION_REMOVAL);
                 removeIntersections(text_zones);
             }
         }
 
         if (remove_empty_space_y) {
-            std::map<int, size_t> text_zones_by_y = getSortedTextZones(text_zones);
-            while (!text_zones_by_y.empty()) {
-                const auto base_zone_iterator = text_zones_by_y.begin();
-                TextZone & base_zone = text_zones.at(base_zone_iterator->second);
-                const size_t base_zone_index = base_zone_iterator->second;
-                const cv::Rect base_rect = base_zone.getZoneRect();
-                const cv::Rect base_rect_extended(base_rect.x, 0, base_rect.width, INT_MAX - 1);
-
-                int movable_distance = base_rect.y;
-                for (size_t i = 0; i < text_zones.size(); i++) {
-                    if (i == base_zone_index)
-                        continue;
-
-                    cv::Rect intersection = text_zones.at(i).getZoneRect() & base_rect_extended;
-                    int current_distance = base_rect.y - intersection.y - intersection.height;
-                    if (current_distance > 0)
-                        movable_distance = std::min(movable_distance, current_distance);
-                }
-
-                base_zone.shift(0, -movable_distance);
-                text_zones_by_y.erase(base_zone_iterator);
-            }
+            BurnStatsRecorder::Scope scope(m_stats, BurnStats::EMPTY_SPACE_REMOVAL);
+            removeEmptySpaceY(text_zones);
         }
     }
 
 private:
-    void removeIntersections(std::vector<TextZone> & text_zones) {
-        std::map<int, size_t> text_zones_by_y = getSortedTextZones(text_zones);
-        while (!text_zones_by_y.empty()) {
-            const auto base_zone_iterator = text_zones_by_y.begin();
-            const size_t current_index = base_zone_iterator->second;
-            const TextZone base_zone = text_zones.at(base_zone_iterator->second);
-            const cv::Rect base_rect = base_zone.getZoneRect();
-            for (size_t i = 0; i < text_zones.size(); i++) {
+    /// hinted advance in pixels, glyph is only loaded - rendering is not needed for metrics
+    static long calculateSymbolWidth(FT_Face & face, const uint glyph_index, const uint font_size) {
+        FT_Set_Pixel_Sizes(face, font_size, 0);
+        FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
+
+        /* FreeType 2 uses size objects to model all information related to a given character size for a given face.
+         * For example, a size object holds the value of certain metrics like the ascender or text height,
+         * expressed in 1/64th of a pixel, for a character size of 12 points (however, those values are rounded to integers, i.e., multiples of 64).
+        */
+        return face->glyph->advance.x / 64;
+    }
+
+    void removeIntersections(TextZoneStore & text_zones) {
+        const std::vector<size_t> text_zones_by_y = getSortedTextZones(text_zones);
+        ZoneGrid grid(text_zones.getZoneRects());
+        std::vector<size_t> candidates;
+        for (const size_t current_index : text_zones_by_y) {
+            const cv::Rect base_rect = text_zones.getZoneRect(current_index);
+            /// only zones sharing a grid cell with base can intersect it; each of them is moved independently of the others
+            grid.findCandidates(base_rect, candidates);
+            for (const size_t i : candidates) {
                 if (i == current_index)
                     continue;
 
-                cv::Rect current_rect = text_zones.at(i).getZoneRect();
+                const cv::Rect current_rect = text_zones.getZoneRect(i);
                 cv::Rect intersection = base_rect & current_rect;
                 if (intersection.empty())
                     continue;
@@ -306,32 +201,48 @@ private:
                 const int8_t x_direction = base_rect.x - current_rect.x > 0 ? -1 : 1;
                 const int8_t y_direction = base_rect.x - current_rect.y > 0 ? -1 : 1;
 
-                if (intersection.empty())
-                    return;
-
                 if (intersection.width >= (base_rect.width / 2.5)) {
                     /// using shift on oY
                     if (y_direction > 0)
-                        text_zones.at(i).move(cv::Point(current_rect.x, base_rect.y + 1));
+                        text_zones.move(i, cv::Point(current_rect.x, base_rect.y + 1));
                     else
-                        text_zones.at(i).move(cv::Point(current_rect.x, current_rect.y - current_rect.height - 1));
+                        text_zones.move(i, cv::Point(current_rect.x, current_rect.y - current_rect.height - 1));
                 } else {
                     /// using shift on oX
                     if (x_direction > 0)
-                        text_zones.at(i).move(cv::Point(base_rect.x + base_rect.width + 1, current_rect.y));
+                        text_zones.move(i, cv::Point(base_rect.x + base_rect.width + 1, current_rect.y));
                     else
-                        text_zones.at(i).move(cv::Point(base_rect.x - current_rect.width - 1, current_rect.y));
+                        text_zones.move(i, cv::Point(base_rect.x - current_rect.width - 1, current_rect.y));
                 }
+                grid.move(i, text_zones.getZoneRect(i));
             }
-            text_zones_by_y.erase(base_zone_iterator);
         }
     }
 
-    std::map<int, size_t> getSortedTextZones(const std::vector<TextZone> & text_zones) {
-        std::map<int, size_t> text_zones_by_y;
+    /// Moves every zone up, in order of y, until it touches a zone above it sharing some x or the top of image
+    void removeEmptySpaceY(TextZoneStore & text_zones) {
+        const std::vector<size_t> text_zones_by_y = getSortedTextZones(text_zones);
+        /// zones below base have not moved yet and lie at or under its y, so only the ones already placed can stop it
+        ZoneSkyline skyline(text_zones.getZoneRects());
+        for (const size_t base_zone_index : text_zones_by_y) {
+            const cv::Rect base_rect = text_zones.getZoneRect(base_zone_index);
+            /// bottoms at or below 0 do not count
+            const int top_limit = std::max(0, skyline.findBottomAbove(base_rect.x, base_rect.width, base_rect.y));
+            text_zones.shift(base_zone_index, 0, top_limit - base_rect.y);
+            skyline.add(text_zones.getZoneRect(base_zone_index));
+        }
+    }
+
+    /// zone indices ordered by y, zones sharing y keep their order
+    std::vector<size_t> getSortedTextZones(const TextZoneStore & text_zones) {
+        std::vector<size_t> text_zones_by_y(text_zones.size());
         for (size_t i = 0; i < text_zones.size(); i++)
-            text_zones_by_y.insert(std::make_pair(text_zones.at(i).getZoneRect().y, i));
+            text_zones_by_y[i] = i;
 
+        const std::vector<cv::Rect> & rects = text_zones.getZoneRects();
+        std::stable_sort(text_zones_by_y.begin(), text_zones_by_y.end(), [&](const size_t left, const size_t right) {
+            return rects[left].y < rects[right].y;
+        });
         return text_zones_by_y;
     }
 
@@ -346,17 +257,165 @@ private:
 
 private:
     const int m_image_width;
+    uint32_t m_operate_flags;
     std::vector<bool> m_work_mode;
+    BurnStatsRecorder * m_stats = nullptr;
 };
 
 /******************************************************************/
 
-class TextBurnerException : public std::exception {
+/// LRU cache of positioned text zones, so repeated captions skip TextPositioner completely
+class LayoutCache {
 public:
-    TextBurnerException(std::string msg) : m_msg(std::move(msg)) {}
-    const char * what() const noexcept override {return (m_msg.c_str());}
+    explicit LayoutCache(const size_t capacity = 64)
+        : m_capacity(capacity) {
+    }
+
+    /// Hash of everything the layout depends on. rects are zone rects before positioning
+    static uint64_t makeKey(const TextZoneStore & text_zones, const int image_width, const uint font_size, const uint32_t flags) {
+        uint64_t hash = 14695981039346656037ULL;
+        auto mix = [&hash](const uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ULL;
+        };
+
+        mix(static_cast<uint64_t>(image_width));
+        mix(font_size);
+        mix(flags);
+        for (size_t i = 0; i < text_zones.size(); i++) {
+            const cv::Rect & rect = text_zones.getZoneRect(i);
+            mix(static_cast<uint32_t>(rect.x));
+            mix(static_cast<uint32_t>(rect.y));
+            mix(static_cast<uint32_t>(rect.width));
+            mix(static_cast<uint32_t>(rect.height));
+            const std::wstring_view text = text_zones.getText(i);
+            mix(text.size());
+            for (const wchar_t symbol : text)
+                mix(static_cast<uint32_t>(symbol));
+        }
+        return hash;
+    }
+
+    /// Applies a stored layout to text_zones if exactly the same input was laid out before
+    bool restore(const uint64_t key, TextZoneStore & text_zones, const int image_width, const uint font_size, const uint32_t flags) {
+        auto found = m_index.find(key);
+        if (found == m_index.end() || !found->second->matches(text_zones, image_width, font_size, flags)) {
+            m_misses++;
+            return false;
+        }
+
+        m_entries.splice(m_entries.begin(), m_entries, found->second);
+        const Entry & entry = *found->second;
+        text_zones.clearRows();
+        for (size_t i = 0; i < text_zones.size(); i++) {
+            text_zones.setLayout(i, entry.placed_rects[i], TextRows(entry.text_rows.data() + entry.rows_begin[i],
+                                                                    entry.text_rows.data() + entry.rows_begin[i + 1]));
+        }
+
+        m_hits++;
+        return true;
+    }
+
+    /// Remembers layout of text_zones positioned from input_rects
+    void store(const uint64_t key, const std::vector<cv::Rect> & input_rects, const TextZoneStore & text_zones,
+               const int image_width, const uint font_size, const uint32_t flags) {
+        if (m_capacity == 0)
+            return;
+
+        auto found = m_index.find(key);
+        if (found != m_index.end()) {
+            m_entries.erase(found->second);
+            m_index.erase(found);
+        } else if (m_entries.size() >= m_capacity) {
+            m_index.erase(m_entries.back().key);
+            m_entries.pop_back();
+            m_evictions++;
+        }
+
+        Entry entry;
+        entry.key = key;
+        entry.image_width = image_width;
+        entry.font_size = font_size;
+        entry.flags = flags;
+        entry.input_rects = input_rects;
+        entry.placed_rects = text_zones.getZoneRects();
+        entry.text_begin.push_back(0);
+        entry.rows_begin.push_back(0);
+        for (size_t i = 0; i < text_zones.size(); i++) {
+            entry.text.append(text_zones.getText(i));
+            entry.text_begin.push_back(entry.text.size());
+            const TextRows rows = text_zones.getTextRows(i);
+            entry.text_rows.insert(entry.text_rows.end(), rows.begin(), rows.end());
+            entry.rows_begin.push_back(entry.text_rows.size());
+        }
+
+        m_entries.push_front(std::move(entry));
+        m_index[key] = m_entries.begin();
+    }
+
+    /// 0 disables caching
+    void setCapacity(const size_t capacity) {
+        m_capacity = capacity;
+        while (m_entries.size() > m_capacity) {
+            m_index.erase(m_entries.back().key);
+            m_entries.pop_back();
+            m_evictions++;
+        }
+    }
+
+    size_t getCapacity() const { return m_capacity;}
+    size_t size() const { return m_entries.size();}
+    size_t getHits() const { return m_hits;}
+    size_t getMisses() const { return m_misses;}
+    size_t getEvictions() const { return m_evictions;}
+
+    double getHitRate() const {
+        const size_t lookups = m_hits + m_misses;
+        return lookups == 0 ? 0.0 : static_cast<double>(m_hits) / static_cast<double>(lookups);
+    }
+
+    void clear() {
+        m_entries.clear();
+        m_index.clear();
+        m_hits = 0;
+        m_misses = 0;
+        m_evictions = 0;
+    }
+
+private:
+    struct Entry {
+        uint64_t key;
+        int image_width;
+        uint font_size;
+        uint32_t flags;
+        std::vector<cv::Rect> input_rects;
+        std::vector<cv::Rect> placed_rects;
+        std::wstring text;                ///< texts of all zones one after another
+        std::vector<size_t> text_begin;   ///< zones count + 1 offsets into text
+        std::vector<TextRow> text_rows;   ///< rows of all zones one after another
+        std::vector<size_t> rows_begin;   ///< zones count + 1 offsets into text_rows
+
+        /// guards against hash collisions
+        bool matches(const TextZoneStore & text_zones, const int width, const uint size, const uint32_t operate_flags) const {
+            if (image_width != width || font_size != size || flags != operate_flags || input_rects.size() != text_zones.size())
+                return false;
+
+            for (size_t i = 0; i < text_zones.size(); i++) {
+                const std::wstring_view zone_text = std::wstring_view(text).substr(text_begin[i], text_begin[i + 1] - text_begin[i]);
+                if (input_rects[i] != text_zones.getZoneRect(i) || zone_text != text_zones.getText(i))
+                    return false;
+            }
+            return true;
+        }
+    };
+
 private:
-    std::string m_msg;
+    size_t m_capacity;
+    std::list<Entry> m_entries; ///< most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> m_index;
+    size_t m_hits = 0;
+    size_t m_misses = 0;
+    size_t m_evictions = 0;
 };
 
 /******************************************************************/
@@ -364,11 +423,10 @@ private:
 /// Class for testing, do not use it in the main project
 class TextBurnerDebuger {
 public:
-    static void showTextZonesFormation(const std::vector<TextZone> & text_zones) {
+    static void showTextZonesFormation(const TextZoneStore & text_zones) {
         cv::Point left_top(INT_MAX, INT_MAX);
         cv::Point right_bottom(INT_MIN, INT_MIN);
-        for (auto zone : text_zones) {
-            cv::Rect rect = zone.getZoneRect();
+        for (const cv::Rect & rect : text_zones.getZoneRects()) {
             left_top.x = std::min(left_top.x, rect.x);
             left_top.y = std::min(left_top.y, rect.y);
 
@@ -377,164 +435,624 @@ public:
         }
 
         cv::Mat img(right_bottom.y - left_top.y + 1, right_bottom.x - left_top.x + 1, CV_8UC3, cv::Scalar(0, 0, 0));
-        for (auto zone : text_zones) {
-            cv::rectangle(img, zone.getZoneRect(), cv::Scalar(0xFF, 0xFF, 0xFF));
+        for (const cv::Rect & rect : text_zones.getZoneRects()) {
+            cv::rectangle(img, rect, cv::Scalar(0xFF, 0xFF, 0xFF));
         }
         cv::imshow("test", img);
         cv::waitKey(0);
     }
 };
 
+class VideoCaption;
+
 class TextBurner {
 public:
+    /// The font file is shared with other burners through FontRegistry, the face is of this burner alone.
+    /// Throws TextBurnerException if the font can not be loaded
     TextBurner(const std::string & path_to_font) : m_image(nullptr),
+        m_font(FontRegistry::instance().openFace(path_to_font)),
+        m_ft_face(m_font.get()),
+        m_text_layout(m_ft_face, m_glyph_cache),
+        m_text_zones(m_text_layout),
         m_draw_frames(false),
-        m_fit_text_zone_height_to_rows(false) {
+        m_fit_text_zone_height_to_rows(false),
+        m_overlay(false),
+        m_band_opacity(0.0),
+        m_symbols_in_row(80),
+        m_min_font_size(12),
+        m_active_stats(nullptr) {
+    }
 
-      FT_Init_FreeType(&m_ft_library);
-      FT_New_Face(m_ft_library, path_to_font.c_str(), 0, &m_ft_face);
-      FT_Select_Charmap(m_ft_face, FT_ENCODING_UNICODE);
-  }
+    /// text zones and layout refer to the face and the glyph cache of this instance
+    TextBurner(const TextBurner &) = delete;
+    TextBurner & operator=(const TextBurner &) = delete;
 
     void setImage(cv::Mat * image) {
+        /// the pixel format specialization is chosen here once, burning does not branch per pixel
+        if (!m_compositor.setImageType(image->type()))
+            throw TextBurnerException("unsupported image type, expected CV_8UC1, CV_8UC3, CV_8UC4, CV_16UC1 or CV_16UC3");
+
         m_image = image;
-        FT_Set_Pixel_Sizes(m_ft_face, TextPositioner::calculateMonoSpaceFontSize(m_ft_face, m_image->cols), 0);
+
+        /// font size depends only on image width, so it is probed once per width
+        auto font_size = m_font_size_by_width.find(m_image->cols);
+        if (font_size == m_font_size_by_width.end()) {
+            const uint size = TextPositioner::calculateMonoSpaceFontSize(m_ft_face, m_image->cols, m_symbols_in_row, m_min_font_size,
+                                                                         m_glyph_cache.getAtlas());
+            font_size = m_font_size_by_width.emplace(m_image->cols, size).first;
+        }
+
+        if (m_ft_face->size->metrics.x_ppem != font_size->second || m_ft_face->size->metrics.y_ppem != font_size->second)
+            FT_Set_Pixel_Sizes(m_ft_face, font_size->second, 0);
     }
 
-    void appendTextZone(cv::Rect rect, const std::wstring & text) {
-        m_text_zones.push_back(TextZone(text, rect, m_ft_face, 5));
+    /// Font size is chosen so that symbols_in_row characters fill the image width, but it never goes below min_font_size.
+    /// Call before setImage()
+    void setFontSizeParameters(const uint symbols_in_row, const uint min_font_size) {
+        if (symbols_in_row == 0)
+            throw TextBurnerException("symbols_in_row should be positive");
+
+        m_symbols_in_row = symbols_in_row;
+        m_min_font_size = min_font_size;
+        m_font_size_by_width.clear();
     }
 
-    void appendTextZone(cv::Rect rect, const std::string & text) {
-        m_text_zones.push_back(TextZone(toWString(text), rect, m_ft_face, 5));
+    void appendTextZone(cv::Rect rect, const std::wstring_view text) {
+        m_text_zones.append(rect, text, 5);
+    }
+
+    /// text is UTF-8, ill-formed sequences are drawn as U+FFFD
+    void appendTextZone(cv::Rect rect, const std::string_view text) {
+        m_text_zones.append(rect, text, 5);
     }
 
     /// Adding a new line of text, it is not recommended to use it with ::appendTextZone()
-    void appendTextRow(const std::wstring & text) {
+    void appendTextRow(const std::wstring_view text) {
         if (m_image == nullptr)
             throw TextBurnerException("set image before appending text!");
 
         cv::Rect rect(0, 0 + static_cast<int>(m_text_zones.size()) * 50,
                       m_image->cols, 50);
-        m_text_zones.push_back(TextZone(text, rect, m_ft_face, 5));
+        m_text_zones.append(rect, text, 5);
     }
 
-    void appendTextRow(const std::string & text) {
+    void appendTextRow(const std::string_view text) {
         if (m_image == nullptr)
             throw TextBurnerException("set image before appending text!");
 
         cv::Rect rect(0, 0 + static_cast<int>(m_text_zones.size()) * 50,
                       m_image->cols, 50);
-        m_text_zones.push_back(TextZone(toWString(text), rect, m_ft_face, 5));
+        m_text_zones.append(rect, text, 5);
     }
 
     void setDrawTextZoneFrames(const bool draw_frames) { m_draw_frames = draw_frames;}
 
+    /// Text is blended over the background: dst = dst * (1 - a) + color * a, where a = glyph coverage * opacity
+    void setTextColor(const cv::Scalar & color, const double opacity = 1.0) { m_compositor.setTextColor(color, opacity);}
+
+    /// Outline and drop shadow under the text. Their layers are made once per glyph and size, kept in the glyph cache
+    /// and blended together with the fill in one walk over the glyph box
+    void setTextEffects(const TextEffects & effects) {
+        m_effects = effects;
+        m_glyph_cache.setEffects(effects);
+        m_compositor.setLayerColor(EffectGlyph::OUTLINE, effects.outline_color, effects.hasOutline() ? effects.outline_opacity : 0.0);
+        m_compositor.setLayerColor(EffectGlyph::SHADOW, effects.shadow_color, effects.hasShadow() ? effects.shadow_opacity : 0.0);
+    }
+
+    const TextEffects & getTextEffects() const { return m_effects;}
+
+    /// Rendered glyphs survive clearData(), so hits/misses show how much rasterization was reused
+    const GlyphCache & getGlyphCache() const { return m_glyph_cache;}
+
+    /// Glyphs prebuilt by tools/build_glyph_atlas are drawn from the mapped file, the rest are still rendered by FreeType.
+    /// Throws TextBurnerException if the file is damaged or was built from another font
+    void loadGlyphAtlas(const std::string & path) {
+        std::shared_ptr<const GlyphAtlas> atlas = std::make_shared<const GlyphAtlas>(path);
+        if (!atlas->matches(m_ft_face))
+            throw TextBurnerException("glyph atlas " + path + " was built from another font");
+
+        m_glyph_cache.setAtlas(std::move(atlas));
+    }
+
+    /// SDF mode: glyphs are resampled from distance fields rendered once at the base size of atlas, so every image width
+    /// is served by the same fields. Share one atlas between burners of the same font; nullptr goes back to FreeType rendering.
+    /// Metrics are unhinted in this mode, so rows may break slightly differently
+    void setSdfAtlas(std::shared_ptr<SdfGlyphAtlas> atlas) {
+        m_glyph_cache.setSdfAtlas(std::move(atlas));
+        m_layout_cache.clear();
+    }
+
+    /// Layouts of recently burned captions; identical texts and zones on the next frame skip positioning
+    const LayoutCache & getLayoutCache() const { return m_layout_cache;}
+    void setLayoutCacheCapacity(const size_t capacity) { m_layout_cache.setCapacity(capacity);}
+
+    /// Glyphs are composited in parallel by threads threads, each one over its own band of rows. 1 - burn on the calling thread (default),
+    /// 0 - one thread per CPU. Layout and rasterization stay on the calling thread, workers only read the glyph cache
+    void setBurnThreads(const size_t threads) {
+        size_t count = threads;
+        if (count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency());
+
+        if (count == 1)
+            m_worker_pool.reset();
+        else if (m_worker_pool == nullptr || m_worker_pool->getThreadsCount() != count)
+            m_worker_pool.reset(new WorkerPool(count));
+    }
+
+    /// Per-stage timings and counters of burns. Disabled by default, then nothing is measured
+    void setStatsEnabled(const bool enabled) {
+        m_active_stats = enabled ? &m_stats : nullptr;
+        m_glyph_cache.setStats(m_active_stats);
+    }
+
+    /// callback gets stats of every burn and their sum since the last resetBurnStats(); setting it enables stats
+    void setBurnStatsCallback(const BurnStatsRecorder::Callback & callback) {
+        m_stats.setCallback(callback);
+        if (callback)
+            setStatsEnabled(true);
+    }
+
+    const BurnStats & getLastBurnStats() const { return m_stats.getLastBurn();}
+    const BurnStats & getTotalBurnStats() const { return m_stats.getTotal();}
+    void resetBurnStats() { m_stats.reset();}
+
     void clearData() {
         m_image = nullptr;
+        clearTextZones();
+    }
+
+    /// image stays set, zones can be appended and placed again for it
+    void clearTextZones() {
         m_text_zones.clear();
     }
 
-    void burnAllTextZones() {
-        if (m_image == nullptr)
-            return;
+    /// Positions the appended zones for the width of the image as burnAllTextZones() does, without drawing them.
+    /// Returns the height of the caption band, placed zones are read by getTextZones() and forEachZoneGlyph()
+    int placeTextZones() {
+        if (m_text_zones.empty())
+            return 0;
 
+        BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::PLACEMENT);
         TextPositioner text_positioner(m_image->cols);
-        text_positioner.placeCorrectlyTextZones(m_text_zones);
+        text_positioner.setStats(m_active_stats);
+        const uint font_size = getFontSize();
+        const uint32_t flags = text_positioner.getOperateFlags();
+        const uint64_t layout_key = LayoutCache::makeKey(m_text_zones, m_image->cols, font_size, flags);
+        if (!m_layout_cache.restore(layout_key, m_text_zones, m_image->cols, font_size, flags)) {
+            m_input_rects = m_text_zones.getZoneRects();
+
+            text_positioner.placeCorrectlyTextZones(m_text_zones);
+            m_layout_cache.store(layout_key, m_input_rects, m_text_zones, m_image->cols, font_size, flags);
+        }
 
         cv::Point left_top(INT_MAX, INT_MAX);
         cv::Point right_bottom(INT_MIN, INT_MIN);
-        for (auto zone : m_text_zones) {
-            cv::Rect rect = zone.getZoneRect();
+        for (const cv::Rect & rect : m_text_zones.getZoneRects()) {
             left_top.x = std::min(left_top.x, rect.x);
             left_top.y = std::min(left_top.y, rect.y);
 
             right_bottom.x = std::max(right_bottom.x, rect.x + rect.width);
             right_bottom.y = std::max(right_bottom.y, rect.y + rect.height);
         }
+        return static_cast<int>(right_bottom.y - left_top.y);
+    }
 
-        const int image_original_height = m_image->rows;
-        appendBackgroundToImage(cv::Scalar(0, 0, 0, 0), static_cast<int>(right_bottom.y - left_top.y));
-        for (auto & text_zone : m_text_zones) {
-            burnTextZoneToImage(text_zone, 0, image_original_height);
-
-            if (m_draw_frames) {
-                cv::Rect rect = text_zone.getZoneRect();
-                rect.y += image_original_height;
-                cv::rectangle(*m_image, rect, cv::Scalar(255, 255, 255));
+    /// zones as appended, or positioned after placeTextZones()
+    const TextZoneStore & getTextZones() const { return m_text_zones;}
+
+    /// pixel size chosen for the width of the image by setImage()
+    uint getFontSize() const { return m_ft_face->size->metrics.y_ppem;}
+
+    /// px
+    long getRowHeight() { return m_text_layout.getRowHeight();}
+
+    /// Calls draw(glyph, x, y) for every glyph of a placed zone, x and y are of the top left corner of the glyph bitmap
+    /// in the caption band. Effects are not applied, glyph is the plain coverage
+    template <typename DrawFunction>
+    void forEachZoneGlyph(const size_t zone, DrawFunction draw) {
+        forEachZonePen(zone, 0, 0, [&](const CachedGlyph & glyph, const long pen_x, const long baseline) {
+            draw(glyph, static_cast<int>(pen_x + glyph.left), static_cast<int>(baseline - glyph.top));
+        });
+    }
+
+    /// Blends CV_8UC1 coverage in the text color with its top left corner at (x, y) of image
+    void blendCoverage(cv::Mat & image, const cv::Mat & coverage, const int x, const int y) {
+        m_compositor.burn(image, coverage.data, coverage.cols, coverage.rows, static_cast<int>(coverage.step), x, y);
+    }
+
+    /// black and, for 4 channel images, opaque
+    cv::Scalar backgroundColor() const {
+        return m_compositor.toImageScale(cv::Scalar(0, 0, 0, 255));
+    }
+
+    /// Overlay mode burns text into the bottom rows of the image instead of growing it,
+    /// band_opacity darkens those rows first (0 - no band, 1 - black band)
+    void setOverlayMode(const bool overlay, const double band_opacity = 0.0) {
+        m_overlay = overlay;
+        m_band_opacity = std::min(1.0, std::max(0.0, band_opacity));
+    }
+
+    void burnAllTextZones() {
+        if (m_image == nullptr)
+            return;
+
+        beginBurnStats();
+        burnIntoImage();
+        endBurnStats();
+    }
+
+    /// tile is reused for the next one, copy it to keep it
+    typedef std::function<void(const cv::Mat & tile, size_t tile_index)> TileSink;
+
+    /// Streaming mode for texts of any length. UTF-8 text is read from input in small chunks, every line of it is folded
+    /// to the image width and its rows are rasterized into tiles of tile_height rows, which are given to sink one by one.
+    /// Tiles stacked under the image make the text band, the last tile is only as high as the text. The image is left
+    /// untouched, it sets the width, the pixel format and the font size. Memory does not depend on the text length:
+    /// one tile, one chunk of text and the rows which can reach the tile being drawn. A stream that fails to read throws
+    void burnTextStream(std::istream & input, const int tile_height, const TileSink & sink) {
+        if (m_image == nullptr)
+            throw TextBurnerException("set image before burning a text stream!");
+        if (tile_height <= 0)
+            throw TextBurnerException("tile height should be positive");
+
+        StreamTiles tiles{cv::Mat(tile_height, m_image->cols, m_image->type()), 0, 0, {}};
+        const long row_height = std::max(1L, m_text_layout.getRowHeight());
+        long row_y = 0;
+
+        std::vector<char> chunk(16384);
+        std::string bytes;  ///< bytes of the current line not decoded yet, an incomplete sequence at most
+        std::wstring text;  ///< decoded part of the current line, starting with its first unfinished row
+        std::vector<TextRow> rows;
+        bool line_open = false;
+        bool input_left = true;
+        while (input_left) {
+            input.getline(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            size_t stored = static_cast<size_t>(input.gcount());
+            bool line_end = true;
+            if (input.eof()) {
+                input_left = false;
+                if (stored == 0 && !line_open)
+                    break;
+            } else if (input.fail()) {
+                /// a full chunk is the only failure to go on from, the line is longer than it
+                if (input.bad() || stored != chunk.size() - 1)
+                    throw TextBurnerException("can not read the text stream");
+                input.clear();
+                line_end = false;
+            } else {
+                stored--; ///< the newline
+            }
+
+            bytes.append(chunk.data(), stored);
+            const size_t complete = line_end ? bytes.size() : utf8::completePrefixSize(bytes);
+            utf8::decode(std::string_view(bytes).substr(0, complete), text);
+            bytes.erase(0, complete);
+
+            /// the last row may still get more words of this line, it waits for the next chunk
+            m_text_layout.breakIntoRows(text, m_image->cols, rows);
+            const size_t finished_rows = line_end ? rows.size() : rows.size() - 1;
+            for (size_t i = 0; i < finished_rows; i++) {
+                appendStreamRow(tiles, std::wstring_view(text).substr(rows[i].begin, rows[i].end - rows[i].begin), row_y, row_height, sink);
+                row_y += row_height;
             }
+
+            if (line_end)
+                text.clear();
+            else
+                text.erase(0, rows.back().begin);
+            line_open = !line_end;
+        }
+
+        if (row_y == 0)
+            return;
+
+        const long text_bottom = row_y + 5;
+        while (tiles.top < text_bottom)
+            flushStreamTile(tiles, static_cast<int>(std::min<long>(tiles.tile.rows, text_bottom - tiles.top)), row_height, sink);
+    }
+
+    /// Same as burnAllTextZones(), but the image set by setImage() is left untouched and the result goes to destination.
+    /// destination is reused without reallocation when it already has the resulting size and type
+    void burnAllTextZones(cv::Mat & destination) {
+        if (m_image == nullptr)
+            return;
+
+        if (&destination == m_image) {
+            burnAllTextZones();
+            return;
         }
+
+        beginBurnStats();
+        burnIntoDestination(destination);
+        endBurnStats();
     }
 private:
-    /// Add a zone for text zone
-    void appendBackgroundToImage(const cv::Scalar & color, const int height) {
-        m_image->push_back(cv::Mat(height, m_image->cols, m_image->type(), color));
+    /// glyph with the position of its top left corner in the image
+    struct GlyphDraw {
+        const CachedGlyph * glyph; ///< cached glyphs are not moved by later insertions
+        const EffectGlyph * effect; ///< nullptr without effects; otherwise x, y are of the effect box
+        int x;
+        int y;
+
+        int width() const { return effect != nullptr ? effect->width : glyph->width;}
+        int rows() const { return effect != nullptr ? effect->rows : glyph->rows;}
+    };
+
+    void burnIntoImage() {
+        const int band_height = placeTextZones();
+        if (m_overlay) {
+            burnOverlay(*m_image, band_height);
+            return;
+        }
+
+        const int image_original_height = m_image->rows;
+        {
+            BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::IMAGE_GROWTH);
+            const uchar * data = m_image->data;
+            appendBackgroundToImage(backgroundColor(), band_height);
+            countAllocation(data, *m_image);
+        }
+        burnTextZones(*m_image, image_original_height);
+    }
+
+    void burnIntoDestination(cv::Mat & destination) {
+        const int band_height = placeTextZones();
+        BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::IMAGE_GROWTH);
+        const uchar * data = destination.data;
+        if (m_overlay) {
+            m_image->copyTo(destination);
+            countAllocation(data, destination);
+            burnOverlay(destination, band_height);
+            return;
+        }
+
+        const int image_original_height = m_image->rows;
+        destination.create(image_original_height + band_height, m_image->cols, m_image->type());
+        countAllocation(data, destination);
+        cv::Mat image_part = destination.rowRange(0, image_original_height);
+        m_image->copyTo(image_part);
+        destination.rowRange(image_original_height, destination.rows).setTo(backgroundColor());
+        burnTextZones(destination, image_original_height);
+    }
+
+    /// counters of caches are sampled around the burn, their difference goes to stats
+    void beginBurnStats() {
+        if (m_active_stats == nullptr)
+            return;
+
+        m_active_stats->beginBurn();
+        m_stats_start.glyphs_rendered = m_glyph_cache.getMisses();
+        m_stats_start.glyph_cache_hits = m_glyph_cache.getHits();
+        m_stats_start.bytes_allocated = m_glyph_cache.getAllocatedBitmapBytes();
+        m_stats_start.layout_cache_hits = m_layout_cache.getHits();
+        m_stats_start.layout_cache_misses = m_layout_cache.getMisses();
+    }
+
+    void endBurnStats() {
+        if (m_active_stats == nullptr)
+            return;
+
+        BurnStats & burn = m_active_stats->burn();
+        burn.zones = m_text_zones.size();
+        burn.glyphs_rendered = m_glyph_cache.getMisses() - m_stats_start.glyphs_rendered;
+        burn.glyph_cache_hits = m_glyph_cache.getHits() - m_stats_start.glyph_cache_hits;
+        burn.bytes_allocated += m_glyph_cache.getAllocatedBitmapBytes() - m_stats_start.bytes_allocated;
+        burn.layout_cache_hits = m_layout_cache.getHits() - m_stats_start.layout_cache_hits;
+        burn.layout_cache_misses = m_layout_cache.getMisses() - m_stats_start.layout_cache_misses;
+        m_active_stats->endBurn();
+    }
+
+    /// image buffer was (re)allocated if its data moved
+    void countAllocation(const uchar * data_before, const cv::Mat & image) {
+        if (m_active_stats != nullptr && image.data != data_before)
+            m_active_stats->burn().bytes_allocated += image.total() * image.elemSize();
     }
 
-    /// draw text zone
-    void burnTextZoneToImage(const TextZone & text_zone, const int x_0, const int y_0) {
-        FT_UInt previous = 0;
-        long y_advance = 0;
-        long posx = text_zone.getZoneRect().x;
-        long posy = text_zone.getZoneRect().y;
-        long x_advance = 0;
-        std::vector<std::wstring> text_rows = text_zone.getWTextRows();
-        int row_counter = 0;
-        for (const std::wstring & row : text_rows) {
-            row_counter++;
-            for (size_t k = 0; k < row.length(); k++) {
-                uint glyph_index = FT_Get_Char_Index(m_ft_face, static_cast<ulong>(row.c_str()[k]));
-                FT_GlyphSlot slot = m_ft_face->glyph;  /* a small shortcut */
-
-                /* FreeType 2 uses size objects to model all information related to a given character size for a given face.
-                 * For example, a size object holds the value of certain metrics like the ascender or text height,
-                 * expressed in 1/64th of a pixel, for a character size of 12 points (however, those values are rounded to integers, i.e., multiples of 64).
-                */
-                x_advance = slot->advance.x / 64; // should be calculated only after Render_Glyph
-
-                FT_Load_Glyph(m_ft_face, glyph_index, FT_LOAD_DEFAULT);
-                FT_Render_Glyph(slot, FT_RENDER_MODE_NORMAL);
-                y_advance = (slot->metrics.vertAdvance / 64) * row_counter;
-                posx += x_advance;
-                burnBitmapToImage(&slot->bitmap, static_cast<int>(posx + x_0 + slot->bitmap_left - x_advance), static_cast<int>(posy + y_0 + y_advance - slot->bitmap_top));
-                previous = glyph_index;
+    /// text goes to the last band_height rows of image, over a translucent band if requested
+    void burnOverlay(cv::Mat & image, const int band_height) {
+        const int y_0 = std::max(0, image.rows - band_height);
+        if (m_band_opacity > 0.0) {
+            BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::IMAGE_GROWTH);
+            cv::Mat band = image.rowRange(y_0, image.rows);
+            /// color channels only, alpha of 4 channel images is kept
+            const double darkening = 1.0 - m_band_opacity;
+            cv::multiply(band, cv::Scalar(darkening, darkening, darkening, 1.0), band);
+        }
+        burnTextZones(image, y_0);
+    }
+
+    void burnTextZones(cv::Mat & image, const int y_0) {
+        {
+            BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::GLYPH_PLACEMENT);
+            m_glyph_draws.clear();
+            for (size_t i = 0; i < m_text_zones.size(); i++)
+                collectGlyphDraws(i, 0, y_0);
+        }
+
+        BurnStatsRecorder::Scope scope(m_active_stats, BurnStats::COMPOSITING);
+        if (m_active_stats != nullptr)
+            countBlendedPixels(image);
+
+        if (m_worker_pool == nullptr) {
+            for (const GlyphDraw & draw : m_glyph_draws)
+                burnGlyphDraw(m_compositor, image, draw, 0);
+        } else {
+            burnGlyphDrawsInBands(image);
+        }
+
+        if (m_draw_frames) {
+            for (cv::Rect rect : m_text_zones.getZoneRects()) {
+                rect.y += y_0;
+                cv::rectangle(image, rect, m_compositor.toImageScale(cv::Scalar(255, 255, 255, 255)));
             }
-            posx = text_zone.getZoneRect().x;
         }
     }
 
-    /// Draw one char on m_image
-    void burnBitmapToImage(FT_Bitmap * bitmap, const int x_shift, const int y_shift) {
-        for (int row = 0; row < static_cast<int>(bitmap->rows); row++) {
-            for (int col = 0; col < static_cast<int>(bitmap->width); col++) {
-                unsigned char val = bitmap->buffer[col + (row * bitmap->pitch)];
-                if (val != 0) {
-                    m_image->at<cv::Vec3b>(row + y_shift, col + x_shift) = cv::Vec3b(val, val, val);
-                }
+    void countBlendedPixels(const cv::Mat & image) {
+        BurnStats & burn = m_active_stats->burn();
+        burn.glyphs_drawn += m_glyph_draws.size();
+        const cv::Rect image_rect(0, 0, image.cols, image.rows);
+        for (const GlyphDraw & draw : m_glyph_draws)
+            burn.pixels_blended += static_cast<size_t>((cv::Rect(draw.x, draw.y, draw.width(), draw.rows()) & image_rect).area());
+    }
+
+    /// Splits rows covered by glyphs into disjoint bands, each band is composited by its own thread and compositor.
+    /// A glyph crossing a band border is clipped by both bands, so every pixel gets the same blends in the same order
+    void burnGlyphDrawsInBands(cv::Mat & image) {
+        int top = image.rows;
+        int bottom = 0;
+        for (const GlyphDraw & draw : m_glyph_draws) {
+            top = std::min(top, std::max(0, draw.y));
+            bottom = std::max(bottom, std::min(image.rows, draw.y + draw.rows()));
+        }
+        if (bottom <= top)
+            return;
+
+        /// a band thinner than a text row is not worth a thread
+        const int row_height = std::max(1L, m_text_layout.getRowHeight());
+        const int bands = static_cast<int>(std::min<long>(static_cast<long>(m_worker_pool->getThreadsCount()),
+                                                          std::max(1, (bottom - top) / row_height)));
+        const int band_height = (bottom - top + bands - 1) / bands;
+
+        m_band_compositors.resize(static_cast<size_t>(bands));
+        for (GlyphCompositor & compositor : m_band_compositors)
+            compositor = m_compositor;
+
+        m_worker_pool->parallelFor(static_cast<size_t>(bands), [&](const size_t band) {
+            const int band_top = top + static_cast<int>(band) * band_height;
+            const int band_bottom = std::min(bottom, band_top + band_height);
+            if (band_top >= band_bottom)
+                return;
+
+            cv::Mat band_image = image.rowRange(band_top, band_bottom);
+            GlyphCompositor & compositor = m_band_compositors[band];
+            for (const GlyphDraw & draw : m_glyph_draws) {
+                if (draw.y < band_bottom && draw.y + draw.rows() > band_top)
+                    burnGlyphDraw(compositor, band_image, draw, band_top);
             }
+        });
+    }
+
+    /// Add a zone for text zone
+    void appendBackgroundToImage(const cv::Scalar & color, const int height) {
+        m_image->push_back(cv::Mat(height, m_image->cols, m_image->type(), color));
+    }
+
+    /// Resolves glyphs and positions of a text zone; missing glyphs are rendered here, on the calling thread
+    void collectGlyphDraws(const size_t zone, const int x_0, const int y_0) {
+        forEachZonePen(zone, x_0, y_0, [&](const CachedGlyph & glyph, const long pen_x, const long baseline) {
+            m_glyph_draws.push_back(makeGlyphDraw(glyph, pen_x, baseline));
+        });
+    }
+
+    /// Calls draw(glyph, pen_x, baseline) for every glyph of a zone, in image coordinates shifted by x_0, y_0
+    template <typename DrawFunction>
+    void forEachZonePen(const size_t zone, const int x_0, const int y_0, DrawFunction draw) {
+        const cv::Rect & zone_rect = m_text_zones.getZoneRect(zone);
+        const std::wstring_view text = m_text_zones.getText(zone);
+        const long row_height = m_text_layout.getRowHeight();
+        long baseline = zone_rect.y + y_0;
+        for (const TextRow & row : m_text_zones.getTextRows(zone)) {
+            baseline += row_height;
+            m_text_layout.forEachGlyph(text.substr(row.begin, row.end - row.begin), [&](const CachedGlyph & glyph, const long pen_x) {
+                draw(glyph, zone_rect.x + x_0 + pen_x, baseline);
+            });
         }
     }
 
-    std::wstring toWString(const std::string & string) {
-        try {
-            using convert_typeX = std::codecvt_utf8<wchar_t>;
-            std::wstring_convert<convert_typeX, wchar_t> converterX;
-            return converterX.from_bytes(string);
-        } catch (std::out_of_range & exception) {
-            throw TextBurnerException(std::string("Не удается конвертировать std::string <STR>" + string + "</STR> в std::wstring; ex.what()=" + exception.what()));
+    /// row of a text stream, y is from the top of the text band
+    struct StreamRow {
+        std::wstring text;
+        long y;
+    };
+
+    struct StreamTiles {
+        cv::Mat tile;
+        long top; ///< of the current tile in the text band
+        size_t index;
+        std::deque<StreamRow> rows; ///< rows which can reach the current tile
+    };
+
+    /// Glyphs may stick out of their row by a row height at most, so a row is kept until tiles are below its reach
+    void appendStreamRow(StreamTiles & tiles, const std::wstring_view text, const long y, const long row_height, const TileSink & sink) {
+        while (y - row_height >= tiles.top + tiles.tile.rows)
+            flushStreamTile(tiles, tiles.tile.rows, row_height, sink);
+
+        tiles.rows.push_back(StreamRow{std::wstring(text), y});
+    }
+
+    /// Draws the rows reaching the current tile, gives its first height rows to sink and moves on to the next tile
+    void flushStreamTile(StreamTiles & tiles, const int height, const long row_height, const TileSink & sink) {
+        cv::Mat tile = tiles.tile.rowRange(0, height);
+        tile.setTo(backgroundColor());
+        for (const StreamRow & row : tiles.rows) {
+            if (row.y + 2 * row_height <= tiles.top || row.y - row_height >= tiles.top + height)
+                continue;
+
+            const long baseline = row.y + row_height - tiles.top;
+            m_text_layout.forEachGlyph(row.text, [&](const CachedGlyph & glyph, const long pen_x) {
+                burnGlyphDraw(m_compositor, tile, makeGlyphDraw(glyph, pen_x, baseline), 0);
+            });
         }
-        return L"";
+        sink(tile, tiles.index++);
+
+        tiles.top += tiles.tile.rows;
+        while (!tiles.rows.empty() && tiles.rows.front().y + 2 * row_height <= tiles.top)
+            tiles.rows.pop_front();
+    }
+
+    /// glyph at the pen position on the baseline, with its effect layers if effects are on
+    GlyphDraw makeGlyphDraw(const CachedGlyph & glyph, const long pen_x, const long baseline) {
+        if (!m_effects.enabled())
+            return GlyphDraw{&glyph, nullptr, static_cast<int>(pen_x + glyph.left), static_cast<int>(baseline - glyph.top)};
+
+        const EffectGlyph & effect = m_glyph_cache.getEffectGlyph(glyph);
+        return GlyphDraw{&glyph, &effect, static_cast<int>(pen_x + effect.left), static_cast<int>(baseline - effect.top)};
+    }
+
+    /// y_0 - row of image the draw coordinates start from
+    static void burnGlyphDraw(GlyphCompositor & compositor, cv::Mat & image, const GlyphDraw & draw, const int y_0) {
+        if (draw.effect != nullptr)
+            compositor.burnLayers(image, *draw.effect, draw.x, draw.y - y_0);
+        else
+            burnBitmapToImage(compositor, image, *draw.glyph, draw.x, draw.y - y_0);
+    }
+
+    /// Draw one char on image
+    static void burnBitmapToImage(GlyphCompositor & compositor, cv::Mat & image, const CachedGlyph & glyph,
+                                  const int x_shift, const int y_shift) {
+        compositor.burn(image, glyph.coverage(), glyph.width, glyph.rows, glyph.width, x_shift, y_shift);
     }
 
 private:
     cv::Mat * m_image;
-    std::vector<TextZone> m_text_zones;
 
-    FT_Library m_ft_library;
-    FT_Face m_ft_face; /* handle to face object */
+    FontFace m_font;
+    FT_Face m_ft_face; /* handle to face object, owned by m_font */
+    GlyphCache m_glyph_cache;
+    TextLayout m_text_layout;
+    TextZoneStore m_text_zones;
+    std::vector<cv::Rect> m_input_rects;
+    LayoutCache m_layout_cache;
+    GlyphCompositor m_compositor;
+    TextEffects m_effects;
+
+    std::vector<GlyphDraw> m_glyph_draws;
+    std::unique_ptr<WorkerPool> m_worker_pool;
+    std::vector<GlyphCompositor> m_band_compositors;
 
     bool m_draw_frames;
     bool m_fit_text_zone_height_to_rows;
+    bool m_overlay;
+    double m_band_opacity;
+
+    uint m_symbols_in_row;
+    uint m_min_font_size;
+    std::map<int, uint> m_font_size_by_width;
+
+    BurnStatsRecorder m_stats;
+    BurnStatsRecorder * m_active_stats; ///< nullptr while stats are disabled
+    BurnStats m_stats_start;            ///< cache counters at the beginning of the burn
 };
 
 }
@@ -0,0 +1,21 @@
+#ifndef TEXTBURNEREXCEPTION_H
+#define TEXTBURNEREXCEPTION_H
+
+#include <string>
+#include <exception>
+
+namespace netline {
+namespace module {
+
+class TextBurnerException : public std::exception {
+public:
+    TextBurnerException(std::string msg) : m_msg(std::move(msg)) {}
+    const char * what() const noexcept override {return (m_msg.c_str());}
+private:
+    std::string m_msg;
+};
+
+}
+}
+
+#endif // TEXTBURNEREXCEPTION_H
@@ -0,0 +1,259 @@
+#ifndef TEXTLAYOUT_H
+#define TEXTLAYOUT_H
+
+#include <vector>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+#include FT_ADVANCES_H
+
+#include "GlyphCache.h"
+
+namespace netline {
+namespace module {
+
+/// One line of text: [begin, end) offsets into the text it was made from
+struct TextRow {
+    size_t begin;
+    size_t end;
+    long width; ///< px
+};
+
+/// Metrics of the face at one pixel size, px
+struct FontMetrics {
+    bool fixed_width = false; ///< every glyph advances by cell_width or not at all and there is no kerning
+    long cell_width = 0;      ///< advance of 'w'
+    long row_height = 0;
+};
+
+/******************************************************************/
+
+/// Measures text with per-glyph advances and kerning of the current face size and folds it into rows.
+/// Fixed width faces (Cousine and other monospace fonts) take a path of their own: a glyph advances by the cell width
+/// of the size or, for combining marks and the like, by nothing, so positions are counted without looking glyphs up
+class TextLayout {
+public:
+    TextLayout(FT_Face & face, GlyphCache & glyph_cache)
+        : m_ft_face(face),
+          m_glyph_cache(glyph_cache),
+          m_fixed_width(false),
+          m_metrics_sdf_atlas(nullptr) {
+        for (uint symbol = 0; symbol < ASCII_COUNT; symbol++)
+            m_ascii_indexes[symbol] = FT_Get_Char_Index(m_ft_face, symbol);
+
+        /// which glyphs have any advance at all, read once from the metrics table in font units. Faces flagged fixed pitch
+        /// which still have glyphs of another width (double width CJK) are laid out glyph by glyph
+        if (FT_IS_FIXED_WIDTH(m_ft_face) && !FT_HAS_KERNING(m_ft_face) && m_ft_face->num_glyphs > 0) {
+            std::vector<FT_Fixed> advances(static_cast<size_t>(m_ft_face->num_glyphs));
+            if (FT_Get_Advances(m_ft_face, 0, static_cast<FT_UInt>(advances.size()), FT_LOAD_NO_SCALE, advances.data()) == 0) {
+                const FT_Fixed cell = *std::max_element(advances.begin(), advances.end());
+                m_fixed_width = std::all_of(advances.begin(), advances.end(), [cell](const FT_Fixed advance) {
+                    return advance == 0 || advance == cell;
+                });
+                m_spacing.resize(advances.size());
+                for (size_t i = 0; i < advances.size(); i++)
+                    m_spacing[i] = advances[i] != 0;
+            }
+        }
+    }
+
+    /// characters of the glyph atlas and ASCII are mapped without FreeType
+    uint getGlyphIndex(const wchar_t symbol) const {
+        if (static_cast<uint32_t>(symbol) < ASCII_COUNT)
+            return m_ascii_indexes[symbol];
+
+        const GlyphAtlas * atlas = m_glyph_cache.getAtlas();
+        uint glyph_index = 0;
+        if (atlas != nullptr && atlas->findGlyphIndex(static_cast<uint32_t>(symbol), glyph_index))
+            return glyph_index;
+        return FT_Get_Char_Index(m_ft_face, static_cast<ulong>(symbol));
+    }
+
+    const CachedGlyph & getGlyph(const uint glyph_index) {
+        return m_glyph_cache.getGlyph(m_ft_face, glyph_index);
+    }
+
+    /// horizontal adjustment between two glyphs, px
+    long getKerning(const uint left_glyph_index, const uint right_glyph_index) const {
+        if (left_glyph_index == 0 || right_glyph_index == 0 || !FT_HAS_KERNING(m_ft_face))
+            return 0;
+
+        FT_Vector delta;
+        FT_Get_Kerning(m_ft_face, left_glyph_index, right_glyph_index, FT_KERNING_DEFAULT, &delta);
+        return delta.x / 64;
+    }
+
+    /// Metrics of the size currently selected on face, worked out on the first use of the size
+    const FontMetrics & getMetrics() {
+        const SdfGlyphAtlas * sdf_atlas = m_glyph_cache.getSdfAtlas();
+        if (sdf_atlas != m_metrics_sdf_atlas) {
+            /// distance field glyphs are unhinted, their advances differ from the hinted ones
+            m_metrics_by_size.clear();
+            m_metrics_sdf_atlas = sdf_atlas;
+        }
+
+        const uint32_t pixel_size = static_cast<uint32_t>(m_ft_face->size->metrics.x_ppem) << 16 | m_ft_face->size->metrics.y_ppem;
+        auto found = m_metrics_by_size.find(pixel_size);
+        if (found == m_metrics_by_size.end()) {
+            const CachedGlyph & w_glyph = getGlyph(getGlyphIndex(L'w'));
+            FontMetrics metrics;
+            metrics.fixed_width = m_fixed_width;
+            metrics.cell_width = w_glyph.advance_x;
+            metrics.row_height = w_glyph.vert_advance;
+            found = m_metrics_by_size.emplace(pixel_size, metrics).first;
+        }
+        return found->second;
+    }
+
+    /// line height, px
+    long getRowHeight() {
+        return getMetrics().row_height;
+    }
+
+    long measure(const std::wstring_view text) {
+        const FontMetrics & metrics = getMetrics();
+        return metrics.fixed_width ? measure<true>(text, metrics) : measure<false>(text, metrics);
+    }
+
+    /// Calls draw(glyph, pen_x) for every symbol of text, pen_x is relative to the beginning of text
+    template <typename DrawFunction>
+    void forEachGlyph(const std::wstring_view text, DrawFunction draw) {
+        const FontMetrics & metrics = getMetrics();
+        if (metrics.fixed_width)
+            forEachGlyph<true>(text, metrics, draw);
+        else
+            forEachGlyph<false>(text, metrics, draw);
+    }
+
+    /// Word wrap on spaces; a word wider than max_width is folded char by char.
+    /// Single pass over text, rows only refer to it, so nothing is allocated once rows has grown
+    void breakIntoRows(const std::wstring_view text, const long max_width, std::vector<TextRow> & rows) {
+        const FontMetrics & metrics = getMetrics();
+        if (metrics.fixed_width)
+            breakIntoRows<true>(text, max_width, metrics, rows);
+        else
+            breakIntoRows<false>(text, max_width, metrics, rows);
+    }
+
+private:
+    static const uint ASCII_COUNT = 128;
+
+    /// px the pen moves after glyph
+    template <bool MONOSPACE>
+    long getAdvance(const uint glyph_index, const FontMetrics & metrics) {
+        if (MONOSPACE)
+            return glyph_index >= m_spacing.size() || m_spacing[glyph_index] ? metrics.cell_width : 0;
+        return getGlyph(glyph_index).advance_x;
+    }
+
+    template <bool MONOSPACE>
+    long getKerning(const uint left_glyph_index, const uint right_glyph_index) const {
+        return MONOSPACE ? 0 : getKerning(left_glyph_index, right_glyph_index);
+    }
+
+    template <bool MONOSPACE>
+    long measure(const std::wstring_view text, const FontMetrics & metrics) {
+        long width = 0;
+        uint previous = 0;
+        for (const wchar_t symbol : text) {
+            const uint glyph_index = getGlyphIndex(symbol);
+            width += getKerning<MONOSPACE>(previous, glyph_index) + getAdvance<MONOSPACE>(glyph_index, metrics);
+            previous = glyph_index;
+        }
+        return width;
+    }
+
+    template <bool MONOSPACE, typename DrawFunction>
+    void forEachGlyph(const std::wstring_view text, const FontMetrics & metrics, DrawFunction & draw) {
+        long pen_x = 0;
+        uint previous = 0;
+        for (const wchar_t symbol : text) {
+            const uint glyph_index = getGlyphIndex(symbol);
+            pen_x += getKerning<MONOSPACE>(previous, glyph_index);
+            const CachedGlyph & glyph = getGlyph(glyph_index);
+            draw(glyph, pen_x);
+            pen_x += MONOSPACE ? getAdvance<true>(glyph_index, metrics) : glyph.advance_x;
+            previous = glyph_index;
+        }
+    }
+
+    template <bool MONOSPACE>
+    void breakIntoRows(const std::wstring_view text, const long max_width, const FontMetrics & metrics, std::vector<TextRow> & rows) {
+        rows.clear();
+        const uint space_index = getGlyphIndex(L' ');
+        const long space_width = getAdvance<MONOSPACE>(space_index, metrics);
+
+        TextRow row{0, 0, 0};
+        uint row_last_glyph = 0;
+        size_t word_begin = 0;
+        while (true) {
+            const size_t word_end = std::min(text.find(L' ', word_begin), text.size());
+            const std::wstring_view word = text.substr(word_begin, word_end - word_begin);
+
+            if (word_begin == 0) {
+                startRowWithWord<MONOSPACE>(word, word_begin, max_width, metrics, rows, row, row_last_glyph);
+            } else {
+                const uint word_first_glyph = word.empty() ? 0 : getGlyphIndex(word.front());
+                const long width = row.width + getKerning<MONOSPACE>(row_last_glyph, space_index) + space_width
+                        + getKerning<MONOSPACE>(space_index, word_first_glyph) + measure<MONOSPACE>(word, metrics);
+                if (width <= max_width) {
+                    row.end = word_end;
+                    row.width = width;
+                    if (!word.empty())
+                        row_last_glyph = getGlyphIndex(word.back());
+                } else if (word.empty()) {
+                    /// trailing or repeated space of a full row, it stays in the row instead of starting a blank one
+                    row.end = word_end;
+                } else {
+                    /// sending the word to a new line, the space in between is dropped
+                    rows.push_back(row);
+                    startRowWithWord<MONOSPACE>(word, word_begin, max_width, metrics, rows, row, row_last_glyph);
+                }
+            }
+
+            if (word_end >= text.size())
+                break;
+            word_begin = word_end + 1;
+        }
+        rows.push_back(row);
+    }
+
+    /// Puts word at the beginning of row. If it is too wide, full pieces go to rows and the last piece stays in row
+    template <bool MONOSPACE>
+    void startRowWithWord(const std::wstring_view word, const size_t word_offset, const long max_width, const FontMetrics & metrics,
+                          std::vector<TextRow> & rows, TextRow & row, uint & row_last_glyph) {
+        row = TextRow{word_offset, word_offset, 0};
+        row_last_glyph = 0;
+        for (size_t k = 0; k < word.size(); k++) {
+            const uint glyph_index = getGlyphIndex(word[k]);
+            long advance = getKerning<MONOSPACE>(row_last_glyph, glyph_index) + getAdvance<MONOSPACE>(glyph_index, metrics);
+            /// at least one symbol per row, otherwise a narrow zone would never be filled
+            if (row.width + advance > max_width && row.end > row.begin) {
+                rows.push_back(row);
+                row = TextRow{word_offset + k, word_offset + k, 0};
+                advance = getAdvance<MONOSPACE>(glyph_index, metrics);
+            }
+            row.width += advance;
+            row.end++;
+            row_last_glyph = glyph_index;
+        }
+    }
+
+private:
+    FT_Face & m_ft_face;
+    GlyphCache & m_glyph_cache;
+
+    uint m_ascii_indexes[ASCII_COUNT];
+    bool m_fixed_width;
+    std::vector<bool> m_spacing; ///< by glyph index, false for glyphs of zero advance; fixed width faces only
+
+    std::unordered_map<uint32_t, FontMetrics> m_metrics_by_size; ///< by (x_ppem << 16 | y_ppem)
+    const SdfGlyphAtlas * m_metrics_sdf_atlas; ///< the metrics were taken with
+};
+
+}
+}
+
+#endif // TEXTLAYOUT_H
@@ -0,0 +1,163 @@
+#ifndef TEXTZONESTORE_H
+#define TEXTZONESTORE_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <opencv2/opencv.hpp>
+
+#include "TextLayout.h"
+#include "Utf8.h"
+
+namespace netline {
+namespace module {
+
+/// Rows of one zone, a view into the row array of TextZoneStore
+class TextRows {
+public:
+    TextRows(const TextRow * first, const TextRow * last) : m_first(first), m_last(last) {}
+
+    const TextRow * begin() const { return m_first;}
+    const TextRow * end() const { return m_last;}
+    size_t size() const { return static_cast<size_t>(m_last - m_first);}
+    bool empty() const { return m_first == m_last;}
+    const TextRow & operator[](const size_t i) const { return m_first[i];}
+
+private:
+    const TextRow * m_first;
+    const TextRow * m_last;
+};
+
+/******************************************************************/
+
+/// Text zones as parallel arrays: rects, offsets into one text arena and ranges of one row array.
+/// Positioning walks the rect array without touching texts, and zones of a frame take a few allocations
+/// which are reused by the next frame after clear(), however many zones there are.
+/// Views returned by getText() and getTextRows() are valid until the store is changed
+class TextZoneStore {
+public:
+    explicit TextZoneStore(TextLayout & layout)
+        : m_layout(&layout) {
+    }
+
+    /// returns index of the zone
+    size_t append(const cv::Rect & rect, const std::wstring_view text, const int text_space = 0) {
+        const size_t text_begin = m_text.size();
+        m_text.append(text);
+        return appendZone(rect, text_begin, text_space);
+    }
+
+    /// text is UTF-8, decoded straight into the arena
+    size_t append(const cv::Rect & rect, const std::string_view text, const int text_space = 0) {
+        const size_t text_begin = m_text.size();
+        utf8::decode(text, m_text);
+        return appendZone(rect, text_begin, text_space);
+    }
+
+    size_t size() const { return m_rects.size();}
+    bool empty() const { return m_rects.empty();}
+
+    /// capacity is kept for the next frame
+    void clear() {
+        m_rects.clear();
+        m_text_begin.clear();
+        m_text_space.clear();
+        m_rows_begin.clear();
+        m_rows_end.clear();
+        m_text.clear();
+        m_rows.clear();
+    }
+
+    const cv::Rect & getZoneRect(const size_t zone) const { return m_rects[zone];}
+    const std::vector<cv::Rect> & getZoneRects() const { return m_rects;}
+
+    std::wstring_view getText(const size_t zone) const {
+        const size_t end = zone + 1 < m_text_begin.size() ? m_text_begin[zone + 1] : m_text.size();
+        return std::wstring_view(m_text).substr(m_text_begin[zone], end - m_text_begin[zone]);
+    }
+
+    /// rows as offsets into getText(zone)
+    TextRows getTextRows(const size_t zone) const {
+        return TextRows(m_rows.data() + m_rows_begin[zone], m_rows.data() + m_rows_end[zone]);
+    }
+
+    void move(const size_t zone, const cv::Point move_to) {
+        m_rects[zone].x = move_to.x;
+        m_rects[zone].y = move_to.y;
+    }
+
+    void shift(const size_t zone, const int x, const int y) {
+        m_rects[zone].x += x;
+        m_rects[zone].y += y;
+    }
+
+    void scale(const size_t zone, const double scale_factor) {
+        cv::Rect & rect = m_rects[zone];
+        rect.x = static_cast<int>(rect.x * scale_factor);
+        rect.y = static_cast<int>(rect.y * scale_factor);
+        rect.width = static_cast<int>(rect.width * scale_factor);
+        rect.height = static_cast<int>(rect.height * scale_factor);
+    }
+
+    void resize(const size_t zone, const int width, const int height) {
+        m_rects[zone].width = width;
+        m_rects[zone].height = height;
+    }
+
+    /// Rows of every zone are made again, call before createRowsFromText() or setLayout() of all zones
+    void clearRows() {
+        m_rows.clear();
+        std::fill(m_rows_begin.begin(), m_rows_begin.end(), 0);
+        std::fill(m_rows_end.begin(), m_rows_end.end(), 0);
+    }
+
+    /// Puts zone to a position and rows calculated before, see LayoutCache
+    void setLayout(const size_t zone, const cv::Rect & rect, const TextRows rows) {
+        m_rects[zone] = rect;
+        m_rows_begin[zone] = m_rows.size();
+        m_rows.insert(m_rows.end(), rows.begin(), rows.end());
+        m_rows_end[zone] = m_rows.size();
+    }
+
+    /// Splits text of zone into rows fitting its width and grows its height to the rows if needed
+    void createRowsFromText(const size_t zone, const bool fit_text_zone_height_to_rows) {
+        /// calculate words and split lines acording to it. If single word is too big we are going to use char-by-char split
+        m_layout->breakIntoRows(getText(zone), m_rects[zone].width, m_row_buffer);
+        m_rows_begin[zone] = m_rows.size();
+        m_rows.insert(m_rows.end(), m_row_buffer.begin(), m_row_buffer.end());
+        m_rows_end[zone] = m_rows.size();
+
+        /// adding some height if initial value is not enough
+        const int needed_height = static_cast<int>(m_layout->getRowHeight()) * static_cast<int>(m_row_buffer.size());
+        if (m_rects[zone].height < needed_height || fit_text_zone_height_to_rows)
+            resize(zone, m_rects[zone].width, needed_height);
+
+        resize(zone, m_rects[zone].width, m_rects[zone].height + m_text_space[zone]);
+    }
+
+private:
+    size_t appendZone(const cv::Rect & rect, const size_t text_begin, const int text_space) {
+        m_rects.push_back(rect);
+        m_text_begin.push_back(text_begin);
+        m_text_space.push_back(text_space);
+        m_rows_begin.push_back(m_rows.size());
+        m_rows_end.push_back(m_rows.size());
+        return m_rects.size() - 1;
+    }
+
+private:
+    TextLayout * m_layout;
+    std::vector<cv::Rect> m_rects;
+    std::vector<size_t> m_text_begin; ///< the text of a zone ends where the text of the next one begins
+    std::vector<int> m_text_space;    ///< px added under the rows
+    std::vector<size_t> m_rows_begin;
+    std::vector<size_t> m_rows_end;
+    std::wstring m_text;
+    std::vector<TextRow> m_rows;
+    std::vector<TextRow> m_row_buffer; ///< rows of one zone on their way to m_rows
+};
+
+}
+}
+
+#endif // TEXTZONESTORE_H
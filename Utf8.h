@@ -0,0 +1,135 @@
+#ifndef UTF8_H
+#define UTF8_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+
+namespace netline {
+namespace module {
+
+/// UTF-8 to wchar_t code points without locale machinery. Never throws: every ill-formed sequence
+/// (stray or missing continuation bytes, overlong forms, surrogates, values above U+10FFFF) becomes one U+FFFD,
+/// the way browsers do it (maximal subpart replacement)
+namespace utf8 {
+
+const wchar_t REPLACEMENT_CHARACTER = static_cast<wchar_t>(0xFFFD);
+
+inline void appendCodePoint(const uint32_t code_point, std::wstring & out) {
+    if (sizeof(wchar_t) == 2 && code_point > 0xFFFF) {
+        /// UTF-16 wchar_t (Windows): surrogate pair
+        out.push_back(static_cast<wchar_t>(0xD800 + ((code_point - 0x10000) >> 10)));
+        out.push_back(static_cast<wchar_t>(0xDC00 + ((code_point - 0x10000) & 0x3FF)));
+    } else {
+        out.push_back(static_cast<wchar_t>(code_point));
+    }
+}
+
+/// Appends decoded text to out; out grows at most once, the decoded text is never longer than the input
+inline void decode(const std::string_view text, std::wstring & out) {
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(text.data());
+    const size_t size = text.size();
+    out.reserve(out.size() + size);
+
+    size_t i = 0;
+    while (i < size) {
+        /// ASCII runs are copied eight bytes per check
+        while (i + 8 <= size) {
+            uint64_t block;
+            std::memcpy(&block, bytes + i, sizeof(block));
+            if (block & 0x8080808080808080ULL)
+                break;
+            for (size_t k = 0; k < 8; k++)
+                out.push_back(static_cast<wchar_t>(bytes[i + k]));
+            i += 8;
+        }
+        if (i >= size)
+            break;
+
+        const unsigned char lead = bytes[i];
+        if (lead < 0x80) {
+            out.push_back(static_cast<wchar_t>(lead));
+            i++;
+            continue;
+        }
+
+        size_t length = 0;
+        uint32_t code_point = 0;
+        unsigned char lower = 0x80; ///< range of the second byte, narrower after E0, ED, F0 and F4
+        unsigned char upper = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+            code_point = lead & 0x1F;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            code_point = lead & 0x0F;
+            if (lead == 0xE0)
+                lower = 0xA0;
+            else if (lead == 0xED)
+                upper = 0x9F;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            code_point = lead & 0x07;
+            if (lead == 0xF0)
+                lower = 0x90;
+            else if (lead == 0xF4)
+                upper = 0x8F;
+        } else {
+            out.push_back(REPLACEMENT_CHARACTER);
+            i++;
+            continue;
+        }
+
+        size_t consumed = 1;
+        for (; consumed < length && i + consumed < size; consumed++) {
+            const unsigned char byte = bytes[i + consumed];
+            if (byte < lower || byte > upper)
+                break;
+            code_point = code_point << 6 | (byte & 0x3F);
+            lower = 0x80;
+            upper = 0xBF;
+        }
+
+        if (consumed == length)
+            appendCodePoint(code_point, out);
+        else
+            out.push_back(REPLACEMENT_CHARACTER); ///< the offending byte starts the next sequence
+        i += consumed;
+    }
+}
+
+/// Length of the longest prefix of text that does not end in the middle of a multibyte sequence.
+/// Text read in chunks decodes the same as a whole when the rest is carried over to the next chunk
+inline size_t completePrefixSize(const std::string_view text) {
+    const unsigned char * bytes = reinterpret_cast<const unsigned char *>(text.data());
+    const size_t size = text.size();
+    for (size_t back = 1; back <= 4 && back <= size; back++) {
+        const unsigned char byte = bytes[size - back];
+        if (byte >= 0x80 && byte <= 0xBF)
+            continue;
+
+        size_t length = 1;
+        if (byte >= 0xC2 && byte <= 0xDF)
+            length = 2;
+        else if (byte >= 0xE0 && byte <= 0xEF)
+            length = 3;
+        else if (byte >= 0xF0 && byte <= 0xF4)
+            length = 4;
+        return back < length ? size - back : size;
+    }
+    return size;
+}
+
+inline std::wstring decode(const std::string_view text) {
+    std::wstring out;
+    decode(text, out);
+    return out;
+}
+
+}
+
+}
+}
+
+#endif // UTF8_H
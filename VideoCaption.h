@@ -0,0 +1,227 @@
+#ifndef VIDEOCAPTION_H
+#define VIDEOCAPTION_H
+
+#include <vector>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+#include "TextBurner.h"
+
+namespace netline {
+namespace module {
+
+/// Caption burned into every frame of a video stream. Zones persist between frames and are updated by id;
+/// the caption band is kept as a coverage mask where only zones that changed are rasterized again,
+/// so a frame with the same caption costs one blend of the mask
+class VideoCaption {
+public:
+    explicit VideoCaption(const std::string & path_to_font)
+        : m_burner(path_to_font),
+          m_layout_changed(true),
+          m_font_size(0),
+          m_band_opacity(0.0),
+          m_redrawn_zones(0) {
+    }
+
+    /// returns id of the zone for setZoneText()
+    size_t appendZone(const cv::Rect & rect, const std::wstring & text) {
+        m_zones.push_back(CaptionZone{rect, text});
+        m_layout_changed = true;
+        return m_zones.size() - 1;
+    }
+
+    /// text is UTF-8
+    size_t appendZone(const cv::Rect & rect, const std::string_view text) {
+        return appendZone(rect, utf8::decode(text));
+    }
+
+    /// Nothing is rasterized if text is the same as before
+    void setZoneText(const size_t id, const std::wstring & text) {
+        if (id >= m_zones.size())
+            throw TextBurnerException("no caption zone with id " + std::to_string(id));
+
+        if (m_zones[id].text == text)
+            return;
+
+        m_zones[id].text = text;
+        m_layout_changed = true;
+    }
+
+    /// decodes into a buffer kept between calls, so an unchanged text costs no allocation
+    void setZoneText(const size_t id, const std::string_view text) {
+        m_decoded.clear();
+        utf8::decode(text, m_decoded);
+        setZoneText(id, m_decoded);
+    }
+
+    void clearZones() {
+        m_zones.clear();
+        m_layout_changed = true;
+    }
+
+    void setTextColor(const cv::Scalar & color, const double opacity = 1.0) { m_burner.setTextColor(color, opacity);}
+
+    /// 0 - no band, 1 - black band under the text
+    void setBandOpacity(const double band_opacity) { m_band_opacity = std::min(1.0, std::max(0.0, band_opacity));}
+
+    void setFontSizeParameters(const uint symbols_in_row, const uint min_font_size) {
+        m_burner.setFontSizeParameters(symbols_in_row, min_font_size);
+    }
+
+    /// zones rasterized by the last burn, 0 when the caption did not change
+    size_t getRedrawnZonesCount() const { return m_redrawn_zones;}
+
+    /// Burns the caption into the bottom rows of frame
+    void burn(cv::Mat & frame) {
+        const int band_height = update(frame);
+        if (band_height == 0)
+            return;
+
+        const int y_0 = std::max(0, frame.rows - band_height);
+        if (m_band_opacity > 0.0) {
+            cv::Mat band = frame.rowRange(y_0, frame.rows);
+            /// color channels only, alpha of 4 channel frames is kept
+            const double darkening = 1.0 - m_band_opacity;
+            cv::multiply(band, cv::Scalar(darkening, darkening, darkening, 1.0), band);
+        }
+        m_burner.blendCoverage(frame, m_mask, 0, y_0);
+    }
+
+    /// frame stays untouched, destination gets frame with the caption band appended below it.
+    /// destination is reused without reallocation when it already has the resulting size and type
+    void burn(cv::Mat & frame, cv::Mat & destination) {
+        if (&frame == &destination)
+            throw TextBurnerException("destination of a caption should not be the frame itself");
+
+        const int band_height = update(frame);
+        destination.create(frame.rows + band_height, frame.cols, frame.type());
+        cv::Mat frame_part = destination.rowRange(0, frame.rows);
+        frame.copyTo(frame_part);
+        if (band_height == 0)
+            return;
+
+        destination.rowRange(frame.rows, destination.rows).setTo(m_burner.backgroundColor());
+        m_burner.blendCoverage(destination, m_mask, 0, frame.rows);
+    }
+
+private:
+    struct CaptionZone {
+        cv::Rect rect; ///< as appended, before positioning
+        std::wstring text;
+    };
+
+    /// zone as it is rasterized in the mask
+    struct DrawnZone {
+        cv::Rect rect;
+        std::wstring text;
+    };
+
+    /// Brings the mask up to date with zones and frame width, returns the band height
+    int update(cv::Mat & frame) {
+        m_burner.setImage(&frame);
+        m_redrawn_zones = 0;
+
+        const uint font_size = m_burner.getFontSize();
+        const bool redraw_all = frame.cols != m_mask.cols || font_size != m_font_size;
+        if (!m_layout_changed && !redraw_all)
+            return m_mask.rows;
+
+        m_burner.clearTextZones();
+        for (const CaptionZone & zone : m_zones)
+            m_burner.appendTextZone(zone.rect, zone.text);
+        const int band_height = m_burner.placeTextZones();
+        const TextZoneStore & placed = m_burner.getTextZones();
+
+        if (redraw_all || band_height != m_mask.rows) {
+            m_mask.create(band_height, frame.cols, CV_8UC1);
+            m_mask.setTo(cv::Scalar(0));
+            for (size_t i = 0; i < placed.size(); i++)
+                drawZone(i);
+        } else {
+            redrawChangedZones(placed);
+        }
+
+        m_drawn.resize(placed.size());
+        for (size_t i = 0; i < placed.size(); i++) {
+            if (m_drawn[i].rect != placed.getZoneRect(i) || m_drawn[i].text != placed.getText(i))
+                m_drawn[i] = DrawnZone{placed.getZoneRect(i), std::wstring(placed.getText(i))};
+        }
+
+        m_font_size = font_size;
+        m_layout_changed = false;
+        return band_height;
+    }
+
+    /// Clears the old and the new areas of changed zones and draws again every zone reaching into them.
+    /// Glyphs may stick out of their zone, so the areas are widened by a row height
+    void redrawChangedZones(const TextZoneStore & placed) {
+        const int margin = static_cast<int>(m_burner.getRowHeight());
+        const cv::Rect mask_rect(0, 0, m_mask.cols, m_mask.rows);
+
+        m_dirty_rects.clear();
+        for (size_t i = 0; i < std::max(placed.size(), m_drawn.size()); i++) {
+            const bool was_drawn = i < m_drawn.size();
+            const bool is_placed = i < placed.size();
+            if (was_drawn && is_placed && m_drawn[i].rect == placed.getZoneRect(i) && m_drawn[i].text == placed.getText(i))
+                continue;
+
+            if (was_drawn)
+                m_dirty_rects.push_back(widen(m_drawn[i].rect, margin) & mask_rect);
+            if (is_placed)
+                m_dirty_rects.push_back(widen(placed.getZoneRect(i), margin) & mask_rect);
+        }
+
+        for (const cv::Rect & dirty : m_dirty_rects) {
+            if (!dirty.empty())
+                m_mask(dirty).setTo(cv::Scalar(0));
+        }
+
+        for (size_t i = 0; i < placed.size(); i++) {
+            const cv::Rect reach = widen(placed.getZoneRect(i), margin);
+            for (const cv::Rect & dirty : m_dirty_rects) {
+                if (!(reach & dirty).empty()) {
+                    drawZone(i);
+                    break;
+                }
+            }
+        }
+    }
+
+    /// Coverage of overlapping glyphs is combined with max, so drawing a zone twice changes nothing
+    void drawZone(const size_t zone) {
+        m_burner.forEachZoneGlyph(zone, [this](const CachedGlyph & glyph, const int x, const int y) {
+            const cv::Rect visible = cv::Rect(x, y, glyph.width, glyph.rows) & cv::Rect(0, 0, m_mask.cols, m_mask.rows);
+            for (int row = visible.y; row < visible.y + visible.height; row++) {
+                const uchar * src = glyph.coverage() + (row - y) * glyph.width + (visible.x - x);
+                uchar * dst = m_mask.ptr<uchar>(row) + visible.x;
+                for (int col = 0; col < visible.width; col++)
+                    dst[col] = std::max(dst[col], src[col]);
+            }
+        });
+        m_redrawn_zones++;
+    }
+
+    static cv::Rect widen(const cv::Rect & rect, const int margin) {
+        return cv::Rect(rect.x - margin, rect.y - margin, rect.width + 2 * margin, rect.height + 2 * margin);
+    }
+
+private:
+    TextBurner m_burner;
+    std::vector<CaptionZone> m_zones;
+    std::vector<DrawnZone> m_drawn;
+    std::vector<cv::Rect> m_dirty_rects;
+    cv::Mat m_mask; ///< CV_8UC1 coverage of the caption band
+    std::wstring m_decoded;
+
+    bool m_layout_changed;
+    uint m_font_size;
+    double m_band_opacity;
+    size_t m_redrawn_zones;
+};
+
+}
+}
+
+#endif // VIDEOCAPTION_H
@@ -0,0 +1,115 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace netline {
+namespace module {
+
+/// Fixed set of threads running index ranges in parallel; the calling thread takes part in the work
+class WorkerPool {
+public:
+    explicit WorkerPool(const size_t threads)
+        : m_next_task(0),
+          m_tasks_count(0),
+          m_unfinished(0),
+          m_generation(0),
+          m_stop(false) {
+        for (size_t i = 1; i < threads; i++)
+            m_threads.emplace_back([this]() { workerLoop(); });
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (std::thread & thread : m_threads)
+            thread.join();
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool & operator=(const WorkerPool &) = delete;
+
+    size_t getThreadsCount() const { return m_threads.size() + 1;}
+
+    /// Calls task(i) for every i in [0, count) and returns when all of them are done
+    void parallelFor(const size_t count, const std::function<void(size_t)> & task) {
+        if (count == 0)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_task = &task;
+            m_next_task = 0;
+            m_tasks_count = count;
+            m_unfinished = count;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done.wait(lock, [this]() { return m_unfinished == 0; });
+        m_task = nullptr;
+    }
+
+private:
+    void workerLoop() {
+        size_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [&]() { return m_stop || m_generation != seen_generation; });
+                if (m_stop)
+                    return;
+                seen_generation = m_generation;
+            }
+            runTasks();
+        }
+    }
+
+    void runTasks() {
+        while (true) {
+            size_t index = 0;
+            const std::function<void(size_t)> * task = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_task == nullptr || m_next_task >= m_tasks_count)
+                    return;
+                index = m_next_task++;
+                task = m_task;
+            }
+
+            (*task)(index);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (--m_unfinished == 0)
+                m_done.notify_all();
+        }
+    }
+
+private:
+    std::vector<std::thread> m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+
+    const std::function<void(size_t)> * m_task = nullptr;
+    size_t m_next_task;
+    size_t m_tasks_count;
+    size_t m_unfinished;
+    size_t m_generation;
+    bool m_stop;
+};
+
+}
+}
+
+#endif // WORKERPOOL_H
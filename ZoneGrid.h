@@ -0,0 +1,167 @@
+#ifndef ZONEGRID_H
+#define ZONEGRID_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <opencv2/opencv.hpp>
+
+namespace netline {
+namespace module {
+
+/// Grids over zone rects for finding neighbours without comparing every zone to every other one.
+/// The first level has cells sized after the average zone and holds zones up to 4 x 4 cells; a zone too big for it goes
+/// to the first coarser level, each one with cells 4 times bigger on both axes, so a few huge zones among many small ones
+/// do not spread over thousands of cells. A level whose cells under an area outnumber its zones is searched zone by zone
+class ZoneGrid {
+public:
+    explicit ZoneGrid(const std::vector<cv::Rect> & rects)
+        : m_rects(rects),
+          m_stamp(0) {
+        int cell_width = 1;
+        int cell_height = 1;
+        if (!rects.empty()) {
+            long total_width = 0;
+            long total_height = 0;
+            for (const cv::Rect & rect : rects) {
+                total_width += std::max(1, rect.width);
+                total_height += std::max(1, rect.height);
+            }
+            cell_width = static_cast<int>(std::max(1L, total_width / static_cast<long>(rects.size())));
+            cell_height = static_cast<int>(std::max(1L, total_height / static_cast<long>(rects.size())));
+        }
+        m_levels.push_back(Level{cell_width, cell_height, {}, {}});
+
+        m_stamps.assign(rects.size(), 0);
+        m_versions.assign(rects.size(), 0);
+        m_level_of.assign(rects.size(), 0);
+        for (size_t i = 0; i < rects.size(); i++) {
+            m_level_of[i] = levelOf(rects[i]);
+            m_levels[m_level_of[i]].zones.push_back(static_cast<uint32_t>(i));
+            insert(i);
+        }
+    }
+
+    /// Old cell entries are not searched for, they just become stale and are skipped
+    void move(const size_t index, const cv::Rect & to) {
+        m_versions[index]++;
+        m_rects[index] = to;
+        insert(index);
+    }
+
+    /// Collects every zone whose cells touch area, each one once, in ascending order
+    void findCandidates(const cv::Rect & area, std::vector<size_t> & candidates) {
+        candidates.clear();
+        m_stamp++;
+        for (Level & level : m_levels) {
+            if (level.zones.empty())
+                continue;
+
+            const int col_begin = cellOf(area.x, level.cell_width);
+            const int col_end = cellOf(area.x + std::max(1, area.width) - 1, level.cell_width);
+            const int row_begin = cellOf(area.y, level.cell_height);
+            const int row_end = cellOf(area.y + std::max(1, area.height) - 1, level.cell_height);
+            const long cells = (static_cast<long>(col_end) - col_begin + 1) * (static_cast<long>(row_end) - row_begin + 1);
+
+            if (cells > static_cast<long>(level.zones.size())) {
+                for (const uint32_t index : level.zones) {
+                    if (touches(m_rects[index], area))
+                        report(index, candidates);
+                }
+                continue;
+            }
+
+            for (int row = row_begin; row <= row_end; row++) {
+                for (int col = col_begin; col <= col_end; col++) {
+                    auto cell = level.cells.find(cellKey(col, row));
+                    if (cell == level.cells.end())
+                        continue;
+
+                    for (const Entry & entry : cell->second) {
+                        if (entry.version == m_versions[entry.index])
+                            report(entry.index, candidates);
+                    }
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+private:
+    /// cells of coarser levels stay below 2^30 px on a side
+    static const int MAX_CELL_SIZE = 1 << 28;
+
+    struct Entry {
+        uint32_t index;
+        uint32_t version; ///< entry is stale once the zone has moved
+    };
+
+    struct Level {
+        int cell_width;
+        int cell_height;
+        std::vector<uint32_t> zones;
+        std::unordered_map<uint64_t, std::vector<Entry>> cells;
+    };
+
+    /// the finest level the zone fits into with at most 4 x 4 cells, coarser levels are added on demand
+    uint32_t levelOf(const cv::Rect & rect) {
+        size_t level = 0;
+        while (rect.width > 4 * static_cast<long>(m_levels[level].cell_width) || rect.height > 4 * static_cast<long>(m_levels[level].cell_height)) {
+            if (level + 1 == m_levels.size()) {
+                const Level & last = m_levels.back();
+                if (last.cell_width > MAX_CELL_SIZE || last.cell_height > MAX_CELL_SIZE)
+                    break;
+                m_levels.push_back(Level{4 * last.cell_width, 4 * last.cell_height, {}, {}});
+            }
+            level++;
+        }
+        return static_cast<uint32_t>(level);
+    }
+
+    void insert(const size_t index) {
+        Level & level = m_levels[m_level_of[index]];
+        const cv::Rect & rect = m_rects[index];
+        const Entry entry{static_cast<uint32_t>(index), m_versions[index]};
+        const int col_end = cellOf(rect.x + std::max(1, rect.width) - 1, level.cell_width);
+        const int row_end = cellOf(rect.y + std::max(1, rect.height) - 1, level.cell_height);
+        for (int row = cellOf(rect.y, level.cell_height); row <= row_end; row++) {
+            for (int col = cellOf(rect.x, level.cell_width); col <= col_end; col++)
+                level.cells[cellKey(col, row)].push_back(entry);
+        }
+    }
+
+    void report(const uint32_t index, std::vector<size_t> & candidates) {
+        if (m_stamps[index] != m_stamp) {
+            m_stamps[index] = m_stamp;
+            candidates.push_back(index);
+        }
+    }
+
+    /// the same test as sharing a cell of 1 px, so both ways of searching a level report the same zones
+    static bool touches(const cv::Rect & rect, const cv::Rect & area) {
+        return rect.x < area.x + std::max(1, area.width) && area.x < rect.x + std::max(1, rect.width)
+                && rect.y < area.y + std::max(1, area.height) && area.y < rect.y + std::max(1, rect.height);
+    }
+
+    /// floor division, zones may be moved to negative coordinates
+    static int cellOf(const int coordinate, const int cell_size) {
+        return coordinate >= 0 ? coordinate / cell_size : -((-coordinate + cell_size - 1) / cell_size);
+    }
+
+    static uint64_t cellKey(const int col, const int row) {
+        return static_cast<uint64_t>(static_cast<uint32_t>(col)) << 32 | static_cast<uint32_t>(row);
+    }
+
+private:
+    std::vector<cv::Rect> m_rects;
+    std::vector<Level> m_levels;
+    std::vector<uint32_t> m_level_of;
+    std::vector<uint32_t> m_versions;
+    std::vector<uint32_t> m_stamps; ///< last findCandidates() call that reported the zone
+    uint32_t m_stamp;
+};
+
+}
+}
+
+#endif // ZONEGRID_H
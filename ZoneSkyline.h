@@ -0,0 +1,106 @@
+#ifndef ZONESKYLINE_H
+#define ZONESKYLINE_H
+
+#include <queue>
+#include <vector>
+#include <climits>
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+
+namespace netline {
+namespace module {
+
+/// Bottom edges of zones already put in place, for moving the next zone up to the nearest one above it.
+/// Sweep from the top: a zone is added when it is placed and becomes visible to queries made below its bottom, so the y of
+/// queries must not decrease. Queries are answered by a segment tree over the x edges of zones holding the lowest visible
+/// bottom of every span, so a zone costs O(log n) whatever the layout, instead of a scan over the rows above it.
+/// x of zones must not change while the skyline is used
+class ZoneSkyline {
+public:
+    explicit ZoneSkyline(const std::vector<cv::Rect> & rects) {
+        for (const cv::Rect & rect : rects) {
+            if (rect.width > 0) {
+                m_edges.push_back(rect.x);
+                m_edges.push_back(rect.x + rect.width);
+            }
+        }
+        std::sort(m_edges.begin(), m_edges.end());
+        m_edges.erase(std::unique(m_edges.begin(), m_edges.end()), m_edges.end());
+
+        m_spans = m_edges.size() > 1 ? m_edges.size() - 1 : 0;
+        m_max.assign(4 * std::max<size_t>(1, m_spans), INT_MIN);
+        m_tag.assign(m_max.size(), INT_MIN);
+    }
+
+    /// Zone in its final place; empty zones are never found
+    void add(const cv::Rect & rect) {
+        if (rect.width > 0 && rect.height > 0)
+            m_pending.push(Pending{rect.y + rect.height, spanOf(rect.x), spanOf(rect.x + rect.width)});
+    }
+
+    /// The lowest bottom above y (bottom < y) among added zones overlapping [x, x + width) on oX; INT_MIN if there is none
+    int findBottomAbove(const int x, const int width, const int y) {
+        while (!m_pending.empty() && m_pending.top().bottom < y) {
+            const Pending & zone = m_pending.top();
+            update(1, 0, m_spans, zone.span_begin, zone.span_end, zone.bottom);
+            m_pending.pop();
+        }
+
+        if (width <= 0)
+            return INT_MIN;
+        return query(1, 0, m_spans, spanOf(x), spanOf(x + width));
+    }
+
+private:
+    struct Pending {
+        int bottom;
+        size_t span_begin;
+        size_t span_end;
+
+        bool operator<(const Pending & other) const { return bottom > other.bottom;} ///< the highest bottom on top
+    };
+
+    /// index of the span starting at edge, every edge of a zone is in m_edges
+    size_t spanOf(const int edge) const {
+        return static_cast<size_t>(std::lower_bound(m_edges.begin(), m_edges.end(), edge) - m_edges.begin());
+    }
+
+    /// raises spans [begin, end) to at least bottom; m_tag holds what was applied to a whole node
+    void update(const size_t node, const size_t node_begin, const size_t node_end, const size_t begin, const size_t end, const int bottom) {
+        if (end <= node_begin || node_end <= begin)
+            return;
+
+        m_max[node] = std::max(m_max[node], bottom);
+        if (begin <= node_begin && node_end <= end) {
+            m_tag[node] = std::max(m_tag[node], bottom);
+            return;
+        }
+
+        const size_t middle = (node_begin + node_end) / 2;
+        update(2 * node, node_begin, middle, begin, end, bottom);
+        update(2 * node + 1, middle, node_end, begin, end, bottom);
+    }
+
+    int query(const size_t node, const size_t node_begin, const size_t node_end, const size_t begin, const size_t end) const {
+        if (end <= node_begin || node_end <= begin)
+            return INT_MIN;
+        if (begin <= node_begin && node_end <= end)
+            return m_max[node];
+
+        const size_t middle = (node_begin + node_end) / 2;
+        return std::max(m_tag[node], std::max(query(2 * node, node_begin, middle, begin, end),
+                                              query(2 * node + 1, middle, node_end, begin, end)));
+    }
+
+private:
+    std::vector<int> m_edges; ///< x edges of zones, sorted; span i is [m_edges[i], m_edges[i + 1])
+    size_t m_spans;
+    std::vector<int> m_max;   ///< the lowest bottom within the node
+    std::vector<int> m_tag;   ///< the lowest bottom covering the whole node
+    std::priority_queue<Pending> m_pending; ///< placed, not yet above the queries
+};
+
+}
+}
+
+#endif // ZONESKYLINE_H
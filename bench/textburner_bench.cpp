@@ -0,0 +1,229 @@
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <iostream>
+#include "TextBurner.h"
+
+using namespace netline::module;
+
+/// Headless benchmark of every burning stage over a range of image widths, zone counts and text lengths.
+/// Prints one record per measurement as CSV (default) or JSON, so results of two versions can be diffed
+namespace {
+
+struct Record {
+    std::string stage;
+    int width;
+    size_t zones;
+    size_t text_length;
+    int iterations;
+    double mean_ms;
+    double min_ms;
+};
+
+struct Options {
+    std::string font_path = "./cousine-regular.ttf";
+    bool json = false;
+    bool quick = false; ///< fewer widths and sizes, for a smoke run
+    double min_total_ms = 200.0;
+};
+
+/// Runs prepare() untimed and run() timed until min_total_ms is spent, at least 3 and at most 1000 times
+template <typename PrepareFunction, typename RunFunction>
+Record measure(const Options & options, const std::string & stage, const int width, const size_t zones, const size_t text_length,
+               PrepareFunction prepare, RunFunction run) {
+    Record record{stage, width, zones, text_length, 0, 0.0, 0.0};
+    double total_ms = 0.0;
+    double min_ms = 1e300;
+    while (record.iterations < 3 || (total_ms < options.min_total_ms && record.iterations < 1000)) {
+        prepare();
+        const auto start = std::chrono::steady_clock::now();
+        run();
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        total_ms += ms;
+        min_ms = std::min(min_ms, ms);
+        record.iterations++;
+    }
+    record.mean_ms = total_ms / record.iterations;
+    record.min_ms = min_ms;
+    return record;
+}
+
+std::wstring makeText(std::mt19937 & random, const size_t length) {
+    static const wchar_t alphabet[] = L"abcdefghijklmnopqrstuvwxyz0123456789:.-";
+    std::wstring text;
+    while (text.size() < length) {
+        const size_t word = 1 + random() % 12;
+        for (size_t i = 0; i < word && text.size() < length; i++)
+            text.push_back(alphabet[random() % (sizeof(alphabet) / sizeof(wchar_t) - 1)]);
+        if (text.size() < length)
+            text.push_back(L' ');
+    }
+    return text;
+}
+
+/// detection-label-like zones scattered over the frame, several of them on the same y
+TextZoneStore makeZones(std::mt19937 & random, TextLayout & layout, const int width, const size_t count, const size_t text_length) {
+    TextZoneStore zones(layout);
+    const int height = width * 9 / 16;
+    for (size_t i = 0; i < count; i++) {
+        const int zone_width = std::min(width, 60 + static_cast<int>(random() % 240));
+        const cv::Rect rect(static_cast<int>(random() % static_cast<unsigned>(width - zone_width + 1)),
+                            static_cast<int>(random() % static_cast<unsigned>(height)) / 4 * 4, zone_width, 20);
+        zones.append(rect, makeText(random, text_length), 5);
+    }
+    return zones;
+}
+
+/// every zone a step to the left of the previous one and more than a row under it, so empty space removal lifts each zone
+/// past the gaps left by all the ones above it
+TextZoneStore makeStaircase(TextLayout & layout, const int width, const size_t count) {
+    TextZoneStore zones(layout);
+    const int step = static_cast<int>(layout.getRowHeight()) + 16;
+    for (size_t i = 0; i < count; i++) {
+        const cv::Rect rect(static_cast<int>((count - 1 - i) * static_cast<size_t>(width - 200) / count), static_cast<int>(i) * step, 200, 20);
+        zones.append(rect, L"step", 5);
+    }
+    return zones;
+}
+
+void printRecords(const std::vector<Record> & records, const bool json) {
+    if (json) {
+        std::cout << "[" << std::endl;
+        for (size_t i = 0; i < records.size(); i++) {
+            const Record & r = records[i];
+            std::cout << "  {\"stage\": \"" << r.stage << "\", \"width\": " << r.width << ", \"zones\": " << r.zones
+                      << ", \"text_length\": " << r.text_length << ", \"iterations\": " << r.iterations
+                      << ", \"mean_ms\": " << r.mean_ms << ", \"min_ms\": " << r.min_ms << "}"
+                      << (i + 1 < records.size() ? "," : "") << std::endl;
+        }
+        std::cout << "]" << std::endl;
+        return;
+    }
+
+    std::cout << "stage,width,zones,text_length,iterations,mean_ms,min_ms" << std::endl;
+    for (const Record & r : records) {
+        std::cout << r.stage << "," << r.width << "," << r.zones << "," << r.text_length << "," << r.iterations
+                  << "," << r.mean_ms << "," << r.min_ms << std::endl;
+    }
+}
+
+}
+
+int main(int argc, char ** argv) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0)
+            options.json = true;
+        else if (std::strcmp(argv[i], "--csv") == 0)
+            options.json = false;
+        else if (std::strcmp(argv[i], "--quick") == 0)
+            options.quick = true;
+        else if (std::strcmp(argv[i], "--help") == 0) {
+            std::cout << "usage: " << argv[0] << " [--csv | --json] [--quick] [path_to_font]" << std::endl;
+            return 0;
+        } else
+            options.font_path = argv[i];
+    }
+    if (options.quick)
+        options.min_total_ms = 20.0;
+
+    FT_Library library;
+    FT_Face face;
+    if (FT_Init_FreeType(&library) || FT_New_Face(library, options.font_path.c_str(), 0, &face)) {
+        std::cerr << "can not load font " << options.font_path << std::endl;
+        return 1;
+    }
+    FT_Select_Charmap(face, FT_ENCODING_UNICODE);
+
+    const std::vector<int> widths = options.quick ? std::vector<int>{640, 3840} : std::vector<int>{640, 1280, 1920, 2560, 3840, 7680};
+    const std::vector<size_t> text_lengths = options.quick ? std::vector<size_t>{16, 256} : std::vector<size_t>{16, 64, 256, 1024};
+    const std::vector<size_t> zone_counts = options.quick ? std::vector<size_t>{10, 100} : std::vector<size_t>{1, 10, 100, 1000};
+    /// positioning is also run for crowded frames, where its scaling with the number of zones shows
+    const std::vector<size_t> positioning_zone_counts = options.quick ? zone_counts
+                                                                      : std::vector<size_t>{1, 10, 100, 1000, 3000, 10000};
+    const std::vector<size_t> staircase_zone_counts = options.quick ? std::vector<size_t>{1000} : std::vector<size_t>{1000, 10000, 20000};
+
+    std::vector<Record> records;
+    for (const int width : widths) {
+        const uint font_size = TextPositioner::calculateMonoSpaceFontSize(face, width);
+        records.push_back(measure(options, "font_size", width, 0, 0, [](){}, [&]() {
+            TextPositioner::calculateMonoSpaceFontSize(face, width);
+        }));
+        FT_Set_Pixel_Sizes(face, font_size, 0);
+
+        GlyphCache glyph_cache;
+        TextLayout layout(face, glyph_cache);
+
+        /// cold cache: every printable ASCII glyph is rasterized by FreeType
+        records.push_back(measure(options, "glyph_rendering", width, 0, 95, [&]() { glyph_cache.clear(); }, [&]() {
+            for (wchar_t symbol = 32; symbol < 127; symbol++)
+                layout.getGlyph(layout.getGlyphIndex(symbol));
+        }));
+
+        for (const size_t text_length : text_lengths) {
+            std::mt19937 random(42);
+            const std::wstring text = makeText(random, text_length);
+            TextZoneStore zones(layout);
+            records.push_back(measure(options, "row_splitting", width, 1, text_length,
+                                      [&]() { zones.clear(); zones.append(cv::Rect(0, 0, width, 20), text, 5); },
+                                      [&]() { zones.clearRows(); zones.createRowsFromText(0, false); }));
+
+            /// the same text blended glyph by glyph, the way TextBurner draws a zone
+            zones.clearRows();
+            zones.createRowsFromText(0, false);
+            cv::Mat image(zones.getZoneRect(0).height, width, CV_8UC3, cv::Scalar(0, 0, 0));
+            GlyphCompositor compositor;
+            compositor.setImageType(image.type());
+            records.push_back(measure(options, "compositing", width, 1, text_length, [](){}, [&]() {
+                long baseline = 0;
+                for (const TextRow & row : zones.getTextRows(0)) {
+                    baseline += layout.getRowHeight();
+                    layout.forEachGlyph(std::wstring_view(text).substr(row.begin, row.end - row.begin), [&](const CachedGlyph & glyph, const long pen_x) {
+                        compositor.burn(image, glyph.coverage(), glyph.width, glyph.rows, glyph.width,
+                                        static_cast<int>(pen_x + glyph.left), static_cast<int>(baseline - glyph.top));
+                    });
+                }
+            }));
+        }
+
+        for (const size_t zone_count : positioning_zone_counts) {
+            std::mt19937 random(7);
+            const TextZoneStore input = makeZones(random, layout, width, zone_count, 16);
+            TextZoneStore zones(layout);
+            records.push_back(measure(options, "positioning", width, zone_count, 16, [&]() { zones = input;}, [&]() {
+                TextPositioner positioner(width);
+                positioner.placeCorrectlyTextZones(zones);
+            }));
+        }
+        for (const size_t zone_count : staircase_zone_counts) {
+            const TextZoneStore input = makeStaircase(layout, width, zone_count);
+            TextZoneStore zones(layout);
+            records.push_back(measure(options, "positioning_staircase", width, zone_count, 4, [&]() { zones = input;}, [&]() {
+                TextPositioner positioner(width);
+                positioner.placeCorrectlyTextZones(zones);
+            }));
+        }
+
+        /// whole burn of the same caption into a reused destination, as for consecutive video frames
+        for (const size_t zone_count : zone_counts) {
+            TextBurner burner(options.font_path);
+            cv::Mat image(width * 9 / 16, width, CV_8UC3, cv::Scalar(30, 30, 30));
+            cv::Mat destination;
+            records.push_back(measure(options, "burn", width, zone_count, 16, [&]() {
+                std::mt19937 random(11);
+                burner.clearData();
+                burner.setImage(&image);
+                for (size_t i = 0; i < zone_count; i++) {
+                    const int x = static_cast<int>(random() % static_cast<unsigned>(width - 200));
+                    burner.appendTextZone(cv::Rect(x, static_cast<int>(i % 50) * 4, 200, 20), makeText(random, 16));
+                }
+            }, [&]() { burner.burnAllTextZones(destination); }));
+        }
+    }
+
+    printRecords(records, options.json);
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+    return 0;
+}
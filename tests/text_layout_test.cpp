@@ -0,0 +1,89 @@
+#include <string>
+#include <vector>
+#include <iostream>
+#include "TextLayout.h"
+
+using namespace netline::module;
+
+/// Row splitting checks, run from the repository root: make test
+namespace {
+
+int failures = 0;
+
+std::wstring withoutSpaces(const std::wstring_view text) {
+    std::wstring result;
+    for (const wchar_t symbol : text) {
+        if (symbol != L' ')
+            result.push_back(symbol);
+    }
+    return result;
+}
+
+/// rows are expected as the text they hold with spaces at their ends trimmed
+void checkRows(TextLayout & layout, const std::wstring & text, const long max_width, const std::vector<std::wstring> & expected) {
+    std::vector<TextRow> rows;
+    layout.breakIntoRows(text, max_width, rows);
+
+    std::vector<std::wstring> got;
+    std::wstring symbols;
+    bool fits = true;
+    for (const TextRow & row : rows) {
+        std::wstring_view row_text = std::wstring_view(text).substr(row.begin, row.end - row.begin);
+        symbols += withoutSpaces(row_text);
+        while (!row_text.empty() && row_text.front() == L' ')
+            row_text.remove_prefix(1);
+        while (!row_text.empty() && row_text.back() == L' ')
+            row_text.remove_suffix(1);
+        got.emplace_back(row_text);
+        fits = fits && row.width <= max_width;
+    }
+
+    if (got != expected || symbols != withoutSpaces(text) || !fits) {
+        failures++;
+        std::wcerr << L"FAIL \"" << text << L"\": " << got.size() << L" rows, expected " << expected.size() << std::endl;
+        for (const std::wstring & row : got)
+            std::wcerr << L"    \"" << row << L"\"" << std::endl;
+    }
+}
+
+}
+
+int main(int argc, char ** argv) {
+    const std::string font_path = argc > 1 ? argv[1] : "./cousine-regular.ttf";
+    FT_Library library;
+    FT_Face face;
+    if (FT_Init_FreeType(&library) || FT_New_Face(library, font_path.c_str(), 0, &face)) {
+        std::cerr << "can not load font " << font_path << std::endl;
+        return 1;
+    }
+    FT_Select_Charmap(face, FT_ENCODING_UNICODE);
+
+    GlyphCache glyph_cache;
+    TextLayout layout(face, glyph_cache);
+    for (const uint font_size : {12u, 16u, 27u}) {
+        FT_Set_Pixel_Sizes(face, font_size, 0);
+        const long ten_cells = 10 * layout.measure(L"w");
+
+        checkRows(layout, L"", ten_cells, {L""});
+        checkRows(layout, L"aaaaaaaaaa", ten_cells, {L"aaaaaaaaaa"});
+        /// spaces after a full row do not start a blank one
+        checkRows(layout, L"aaaaaaaaaa ", ten_cells, {L"aaaaaaaaaa"});
+        checkRows(layout, L"aaaaaaaaaa   ", ten_cells, {L"aaaaaaaaaa"});
+        checkRows(layout, L"aaaaa bbbb ", ten_cells, {L"aaaaa bbbb"});
+        checkRows(layout, L"aaaaaaaaaa  bbb", ten_cells, {L"aaaaaaaaaa", L"bbb"});
+        checkRows(layout, L"aaaaa  bbb", ten_cells, {L"aaaaa  bbb"});
+        checkRows(layout, L"aaaaa   bbbb cc", ten_cells, {L"aaaaa", L"bbbb cc"});
+        checkRows(layout, L"  aaa", ten_cells, {L"aaa"});
+        /// a word wider than the row is folded char by char
+        checkRows(layout, L"aaaaaaaaaaaaaaa bb", ten_cells, {L"aaaaaaaaaa", L"aaaaa bb"});
+    }
+
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+    if (failures != 0) {
+        std::cerr << failures << " failed" << std::endl;
+        return 1;
+    }
+    std::cout << "text layout: ok" << std::endl;
+    return 0;
+}
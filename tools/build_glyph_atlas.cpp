@@ -0,0 +1,94 @@
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+#include "TextBurner.h"
+#include "GlyphAtlas.h"
+
+using namespace netline::module;
+
+/// Renders a glyph atlas for TextBurner::loadGlyphAtlas().
+/// By default: font sizes TextBurner picks for common frame widths; Latin-1, Cyrillic, common punctuation, euro, numero and U+FFFD
+namespace {
+
+/// "12,16,20-24" or "0x20-0x7E,0x400-0x4FF"
+std::vector<std::pair<uint32_t, uint32_t>> parseRanges(const std::string & text) {
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (item.empty())
+            continue;
+        const size_t dash = item.find('-');
+        const uint32_t first = static_cast<uint32_t>(std::strtoul(item.substr(0, dash).c_str(), nullptr, 0));
+        const uint32_t last = dash == std::string::npos ? first : static_cast<uint32_t>(std::strtoul(item.substr(dash + 1).c_str(), nullptr, 0));
+        if (last < first)
+            throw TextBurnerException("bad range " + item);
+        ranges.emplace_back(first, last);
+    }
+    return ranges;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    /// every option takes a value, one left without it is a mistake too
+    if (argc < 3 || (argc - 3) % 2 != 0) {
+        std::cerr << "usage: " << argv[0] << " font.ttf output.atlas [--sizes 12,16,20-40] [--chars 0x20-0x7E,0x400-0x4FF]"
+                  << " [--widths 640,1920,3840] [--symbols-in-row 80] [--min-font-size 12]" << std::endl;
+        return 1;
+    }
+
+    const std::string font_path = argv[1];
+    const std::string atlas_path = argv[2];
+    std::string sizes_arg;
+    std::string chars_arg = "0x20-0x7E,0xA0-0xFF,0x400-0x4FF,0x2010-0x2026,0x20AC,0x2116,0xFFFD";
+    std::string widths_arg = "640,720,1280,1920,2560,3840,7680";
+    uint symbols_in_row = 80;
+    uint min_font_size = 12;
+    for (int i = 3; i + 1 < argc; i += 2) {
+        const std::string option = argv[i];
+        if (option == "--sizes")
+            sizes_arg = argv[i + 1];
+        else if (option == "--chars")
+            chars_arg = argv[i + 1];
+        else if (option == "--widths")
+            widths_arg = argv[i + 1];
+        else if (option == "--symbols-in-row")
+            symbols_in_row = static_cast<uint>(std::atoi(argv[i + 1]));
+        else if (option == "--min-font-size")
+            min_font_size = static_cast<uint>(std::atoi(argv[i + 1]));
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        FontFace font = FontRegistry::instance().openFace(font_path);
+        FT_Face face = font.get();
+
+        std::vector<uint> sizes;
+        for (const auto & range : parseRanges(sizes_arg)) {
+            for (uint32_t size = range.first; size <= range.second; size++)
+                sizes.push_back(size);
+        }
+        /// sizes are taken from frame widths when not given explicitly
+        if (sizes.empty()) {
+            for (const auto & width : parseRanges(widths_arg))
+                sizes.push_back(TextPositioner::calculateMonoSpaceFontSize(face, static_cast<int>(width.first), symbols_in_row, min_font_size));
+        }
+
+        GlyphAtlas::build(face, sizes, parseRanges(chars_arg), atlas_path);
+
+        const GlyphAtlas atlas(atlas_path);
+        std::cout << atlas_path << ": " << atlas.getGlyphsCount() << " glyphs, sizes";
+        for (const uint size : sizes)
+            std::cout << " " << size;
+        std::cout << std::endl;
+    } catch (std::exception & ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "TextBurner.h"
+#include "BoundedQueue.h"
+
+using namespace netline::module;
+
+/// Captions a list of images in one process. Decoding, burning and encoding run as overlapping stages connected by bounded
+/// queues, so reading never runs far ahead of writing and memory stays at about (queue size * 2 + threads) images.
+/// --threads is the total of all stages: a third of them decode, a third encode and the rest burn, at least one per stage.
+/// Every burning thread keeps its own TextBurner for the whole run, fonts are mapped once through FontRegistry.
+///
+/// Manifest: one image per line, fields separated by tabs, empty lines and lines starting with # are skipped
+///     input.jpg <TAB> output.jpg <TAB> text of the first row <TAB> text of the second row ...
+/// a field of the form @x,y,w,h:text is a text zone at that rectangle instead of a row. Text is UTF-8
+namespace {
+
+struct Options {
+    std::string manifest_path;
+    std::string font_path = "./cousine-regular.ttf";
+    std::string atlas_path;
+    size_t threads = 0; ///< of all stages together, 0 - one per CPU
+    size_t queue_size = 0; ///< 0 - twice the threads
+    bool overlay = false;
+};
+
+struct Job {
+    size_t line = 0;
+    std::string input_path;
+    std::string output_path;
+    std::vector<std::string> rows;
+    std::vector<std::pair<cv::Rect, std::string>> zones;
+    cv::Mat image;
+};
+
+/// "@x,y,w,h:text" -> zone; false if field is not a zone
+bool parseZone(const std::string & field, cv::Rect & rect, std::string & text) {
+    if (field.empty() || field[0] != '@')
+        return false;
+
+    const size_t colon = field.find(':');
+    if (colon == std::string::npos)
+        return false;
+
+    char separator[3] = {0, 0, 0};
+    std::stringstream stream(field.substr(1, colon - 1));
+    stream >> rect.x >> separator[0] >> rect.y >> separator[1] >> rect.width >> separator[2] >> rect.height;
+    if (stream.fail() || separator[0] != ',' || separator[1] != ',' || separator[2] != ',' || rect.width <= 0 || rect.height <= 0)
+        return false;
+
+    text = field.substr(colon + 1);
+    return true;
+}
+
+/// false if line has no job; throws TextBurnerException if it is malformed
+bool parseJob(const std::string & line, const size_t line_number, Job & job) {
+    if (line.empty() || line[0] == '#')
+        return false;
+
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t'))
+        fields.push_back(field);
+    if (!fields.empty() && !fields.back().empty() && fields.back().back() == '\r')
+        fields.back().pop_back();
+
+    if (fields.size() < 2 || fields[0].empty() || fields[1].empty())
+        throw TextBurnerException("manifest line " + std::to_string(line_number) + ": expected input and output paths");
+
+    job = Job();
+    job.line = line_number;
+    job.input_path = fields[0];
+    job.output_path = fields[1];
+    for (size_t i = 2; i < fields.size(); i++) {
+        cv::Rect rect;
+        std::string text;
+        if (parseZone(fields[i], rect, text))
+            job.zones.emplace_back(rect, std::move(text));
+        else if (!fields[i].empty() && fields[i][0] == '@')
+            throw TextBurnerException("manifest line " + std::to_string(line_number) + ": bad zone " + fields[i]);
+        else
+            job.rows.push_back(fields[i]);
+    }
+    return true;
+}
+
+/// Threads of one stage; the last one to finish closes the queue of the next stage
+class Stage {
+public:
+    template <typename Function>
+    Stage(const size_t threads, BoundedQueue<Job> * output, Function function)
+        : m_running(threads),
+          m_output(output) {
+        for (size_t i = 0; i < threads; i++) {
+            m_threads.emplace_back([this, function, i]() {
+                function(i);
+                if (--m_running == 0 && m_output != nullptr)
+                    m_output->close();
+            });
+        }
+    }
+
+    void join() {
+        for (std::thread & thread : m_threads)
+            thread.join();
+    }
+
+private:
+    std::atomic<size_t> m_running;
+    BoundedQueue<Job> * m_output;
+    std::vector<std::thread> m_threads;
+};
+
+class BatchRunner {
+public:
+    explicit BatchRunner(const Options & options)
+        : m_options(options),
+          m_threads(options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency())),
+          m_coding_threads(std::max<size_t>(1, m_threads / 3)),
+          m_burning_threads(m_threads > 2 * m_coding_threads ? m_threads - 2 * m_coding_threads : 1),
+          m_decode_queue(options.queue_size != 0 ? options.queue_size : m_threads * 2),
+          m_burn_queue(m_decode_queue.capacity()),
+          m_encode_queue(m_decode_queue.capacity()),
+          m_written(0),
+          m_failed(0) {
+        /// burners are made up front, so a missing font or atlas stops the run before any image is read
+        for (size_t i = 0; i < m_burning_threads; i++) {
+            m_burners.emplace_back(new TextBurner(options.font_path));
+            if (!options.atlas_path.empty())
+                m_burners.back()->loadGlyphAtlas(options.atlas_path);
+            m_burners.back()->setOverlayMode(options.overlay, options.overlay ? 0.5 : 0.0);
+        }
+    }
+
+    void run(std::istream & manifest) {
+        Stage decoders(m_coding_threads, &m_burn_queue, [this](size_t) { decode();});
+        Stage burners(m_burning_threads, &m_encode_queue, [this](const size_t worker) { burn(*m_burners[worker]);});
+        Stage encoders(m_coding_threads, nullptr, [this](size_t) { encode();});
+
+        std::string line;
+        size_t line_number = 0;
+        while (std::getline(manifest, line)) {
+            line_number++;
+            try {
+                Job job;
+                if (parseJob(line, line_number, job))
+                    m_decode_queue.push(std::move(job));
+            } catch (std::exception & ex) {
+                fail(ex.what());
+            }
+        }
+        m_decode_queue.close();
+
+        decoders.join();
+        burners.join();
+        encoders.join();
+    }
+
+    size_t getWrittenCount() const { return m_written;}
+    size_t getFailedCount() const { return m_failed;}
+    /// of all stages, more than --threads only when it is below 3
+    size_t getThreadsCount() const { return 2 * m_coding_threads + m_burning_threads;}
+    size_t getBurningThreadsCount() const { return m_burning_threads;}
+
+private:
+    void decode() {
+        Job job;
+        while (m_decode_queue.pop(job)) {
+            try {
+                job.image = cv::imread(job.input_path, cv::IMREAD_COLOR);
+            } catch (std::exception & ex) {
+                fail("line " + std::to_string(job.line) + ": " + ex.what());
+                continue;
+            }
+
+            if (job.image.empty()) {
+                fail("line " + std::to_string(job.line) + ": can not read " + job.input_path);
+                continue;
+            }
+            m_burn_queue.push(std::move(job));
+        }
+    }
+
+    void burn(TextBurner & burner) {
+        Job job;
+        while (m_burn_queue.pop(job)) {
+            try {
+                burner.setImage(&job.image);
+                for (const auto & zone : job.zones)
+                    burner.appendTextZone(zone.first, std::string_view(zone.second));
+                for (const std::string & row : job.rows)
+                    burner.appendTextRow(std::string_view(row));
+                burner.burnAllTextZones();
+                burner.clearData();
+            } catch (std::exception & ex) {
+                burner.clearData();
+                fail("line " + std::to_string(job.line) + ": " + ex.what());
+                continue;
+            }
+            m_encode_queue.push(std::move(job));
+        }
+    }
+
+    void encode() {
+        Job job;
+        while (m_encode_queue.pop(job)) {
+            bool written = false;
+            try {
+                written = cv::imwrite(job.output_path, job.image);
+            } catch (std::exception & ex) {
+                fail("line " + std::to_string(job.line) + ": " + ex.what());
+                continue;
+            }
+
+            if (written)
+                m_written++;
+            else
+                fail("line " + std::to_string(job.line) + ": can not write " + job.output_path);
+        }
+    }
+
+    void fail(const std::string & message) {
+        m_failed++;
+        std::lock_guard<std::mutex> lock(m_log_mutex);
+        std::cerr << message << std::endl;
+    }
+
+private:
+    const Options m_options;
+    const size_t m_threads;
+    const size_t m_coding_threads;  ///< decoding and, as many, encoding
+    const size_t m_burning_threads;
+    BoundedQueue<Job> m_decode_queue;
+    BoundedQueue<Job> m_burn_queue;
+    BoundedQueue<Job> m_encode_queue;
+    std::vector<std::unique_ptr<TextBurner>> m_burners;
+    std::atomic<size_t> m_written;
+    std::atomic<size_t> m_failed;
+    std::mutex m_log_mutex;
+};
+
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        std::cerr << "usage: " << argv[0] << " manifest.tsv [--font cousine-regular.ttf] [--atlas font.atlas]"
+                  << " [--threads N] [--queue N] [--overlay]" << std::endl
+                  << "  --threads N  threads of all stages together (a third decode, a third encode, the rest burn;"
+                  << " at least one per stage), default one per CPU" << std::endl
+                  << "  --queue N    images waiting between two stages, default twice the threads" << std::endl;
+        return 1;
+    }
+
+    Options options;
+    options.manifest_path = argv[1];
+    for (int i = 2; i < argc; i++) {
+        const std::string option = argv[i];
+        if (option == "--overlay") {
+            options.overlay = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "missing value of " << option << std::endl;
+            return 1;
+        }
+
+        const char * value = argv[++i];
+        if (option == "--font")
+            options.font_path = value;
+        else if (option == "--atlas")
+            options.atlas_path = value;
+        else if (option == "--threads")
+            options.threads = static_cast<size_t>(std::atoi(value));
+        else if (option == "--queue")
+            options.queue_size = static_cast<size_t>(std::atoi(value));
+        else {
+            std::cerr << "unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    std::ifstream manifest(options.manifest_path);
+    if (!manifest) {
+        std::cerr << "can not open manifest " << options.manifest_path << std::endl;
+        return 1;
+    }
+
+    try {
+        BatchRunner runner(options);
+        const auto start = std::chrono::steady_clock::now();
+        runner.run(manifest);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << runner.getWrittenCount() << " images in " << seconds << " s, "
+                  << (seconds > 0.0 ? runner.getWrittenCount() / seconds : 0.0) << " images/s, "
+                  << runner.getFailedCount() << " failed, " << runner.getThreadsCount() << " threads ("
+                  << runner.getBurningThreadsCount() << " burning)" << std::endl;
+        return runner.getFailedCount() == 0 ? 0 : 2;
+    } catch (std::exception & ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+}